@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "allocation-profile.h"
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+
+static const char* allocationSubsystemNames[] =
+{
+    "other",
+    "interning",
+    "AST construction",
+    "hierarchy",
+    "method tables",
+    "type environment",
+    "output"
+};
+static_assert(sizeof(allocationSubsystemNames) / sizeof(allocationSubsystemNames[0]) == static_cast<size_t>(AllocationSubsystem::NumSubsystems),
+    "allocationSubsystemNames must have one name per AllocationSubsystem");
+
+static thread_local AllocationSubsystem currentAllocationSubsystem = AllocationSubsystem::Other;
+
+AllocationSubsystem set_allocation_subsystem(AllocationSubsystem subsystem)
+{
+    AllocationSubsystem previous = currentAllocationSubsystem;
+    currentAllocationSubsystem = subsystem;
+    return previous;
+}
+
+struct AllocationTotals
+{
+    int64_t m_allocations;
+    int64_t m_bytes;
+    int64_t m_liveBytes;
+    int64_t m_peakLiveBytes;
+};
+
+// With -A every block operator new returns is kept in this table until it is deleted, so that the delete can be
+// charged to the subsystem that made it. Blocks from before the flags were read aren't in it and are ignored.
+// The table gets its memory from malloc, and everything in it has constant initialization, so it works while the
+// program's static objects are still being constructed or already destroyed.
+class AllocationTable
+{
+public:
+    void Insert(void* memory, size_t size, AllocationSubsystem subsystem)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if ((m_used + 1) * 2 > m_capacity && !Grow()) return; // out of memory, the block goes uncounted
+        Slot& slot = m_slots[FindSlot(memory)];
+        slot.m_address = reinterpret_cast<uintptr_t>(memory);
+        slot.m_size = size;
+        slot.m_subsystem = subsystem;
+        m_used++;
+        Charge(subsystem, size);
+    }
+
+    void Remove(void* memory)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_capacity == 0) return;
+        size_t index = FindSlot(memory);
+        if (m_slots[index].m_address == 0) return;
+
+        Slot removed = m_slots[index];
+        Uncharge(removed.m_subsystem, removed.m_size);
+        EraseSlot(index);
+    }
+
+    void Recharge(const void* memory, AllocationSubsystem subsystem)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_capacity == 0) return;
+        Slot& slot = m_slots[FindSlot(memory)];
+        if (slot.m_address == 0 || slot.m_subsystem == subsystem) return;
+
+        Uncharge(slot.m_subsystem, slot.m_size);
+        m_totals[static_cast<int>(slot.m_subsystem)].m_allocations--;
+        m_totals[static_cast<int>(slot.m_subsystem)].m_bytes -= slot.m_size;
+        m_totals[numTotals - 1].m_allocations--;
+        m_totals[numTotals - 1].m_bytes -= slot.m_size;
+        slot.m_subsystem = subsystem;
+        Charge(subsystem, slot.m_size);
+    }
+
+    // The subsystems in AllocationSubsystem order followed by the whole program
+    void GetTotals(AllocationTotals* totals)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::copy(m_totals, m_totals + numTotals, totals);
+    }
+
+    static const int numTotals = static_cast<int>(AllocationSubsystem::NumSubsystems) + 1;
+
+private:
+    struct Slot
+    {
+        uintptr_t m_address; // 0 for an empty slot
+        size_t m_size;
+        AllocationSubsystem m_subsystem;
+    };
+
+    size_t Hash(uintptr_t address) const
+    {
+        return static_cast<size_t>((address >> 4) * 0x9E3779B97F4A7C15ULL) & (m_capacity - 1);
+    }
+
+    // The slot holding memory, or the empty slot where it would go
+    size_t FindSlot(const void* memory) const
+    {
+        uintptr_t address = reinterpret_cast<uintptr_t>(memory);
+        size_t index = Hash(address);
+        while (m_slots[index].m_address != 0 && m_slots[index].m_address != address) index = (index + 1) & (m_capacity - 1);
+        return index;
+    }
+
+    // Linear probing without tombstones, the entries after the hole that can move back into it do
+    void EraseSlot(size_t hole)
+    {
+        m_slots[hole].m_address = 0;
+        m_used--;
+        for (size_t index = (hole + 1) & (m_capacity - 1); m_slots[index].m_address != 0; index = (index + 1) & (m_capacity - 1))
+        {
+            size_t home = Hash(m_slots[index].m_address);
+            if (((index - home) & (m_capacity - 1)) >= ((index - hole) & (m_capacity - 1)))
+            {
+                m_slots[hole] = m_slots[index];
+                m_slots[index].m_address = 0;
+                hole = index;
+            }
+        }
+    }
+
+    bool Grow()
+    {
+        size_t oldCapacity = m_capacity;
+        Slot* oldSlots = m_slots;
+        size_t capacity = oldCapacity == 0 ? 1 << 16 : oldCapacity * 2;
+        Slot* slots = static_cast<Slot*>(calloc(capacity, sizeof(Slot)));
+        if (slots == nullptr) return false;
+
+        m_slots = slots;
+        m_capacity = capacity;
+        for (size_t i = 0; i < oldCapacity; i++)
+        {
+            if (oldSlots[i].m_address != 0) m_slots[FindSlot(reinterpret_cast<void*>(oldSlots[i].m_address))] = oldSlots[i];
+        }
+        free(oldSlots);
+        return true;
+    }
+
+    void Charge(AllocationSubsystem subsystem, size_t size)
+    {
+        for (AllocationTotals* totals : { &m_totals[static_cast<int>(subsystem)], &m_totals[numTotals - 1] })
+        {
+            totals->m_allocations++;
+            totals->m_bytes += size;
+            totals->m_liveBytes += size;
+            totals->m_peakLiveBytes = std::max(totals->m_peakLiveBytes, totals->m_liveBytes);
+        }
+    }
+
+    void Uncharge(AllocationSubsystem subsystem, size_t size)
+    {
+        m_totals[static_cast<int>(subsystem)].m_liveBytes -= size;
+        m_totals[numTotals - 1].m_liveBytes -= size;
+    }
+
+    std::mutex m_mutex;
+    Slot* m_slots = nullptr;
+    size_t m_capacity = 0;
+    size_t m_used = 0;
+    AllocationTotals m_totals[numTotals] = {};
+};
+
+static AllocationTable allocationTable;
+
+// Only reached with -A, or when malloc fails and the new handler has to be tried
+static void* AllocateProfiled(size_t size)
+{
+    if (size == 0) size = 1;
+    void* memory;
+    while ((memory = malloc(size)) == nullptr)
+    {
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) throw std::bad_alloc();
+        handler();
+    }
+    if (semant_allocation_profile) allocationTable.Insert(memory, size, currentAllocationSubsystem);
+    return memory;
+}
+
+static inline void* AllocateMemory(size_t size)
+{
+    if (semant_allocation_profile == 0)
+    {
+        void* memory = malloc(size);
+        if (memory != nullptr) return memory;
+    }
+    return AllocateProfiled(size);
+}
+
+static inline void FreeMemory(void* memory)
+{
+    if (semant_allocation_profile) allocationTable.Remove(memory);
+    free(memory);
+}
+
+// The replaceable global allocation functions. The nothrow and sized forms the library provides end up in these
+// or in malloc and free, which these are built on, so the two always match. Without -A each is the flag test and
+// the malloc or free call.
+void* operator new(size_t size) { return AllocateMemory(size); }
+void* operator new[](size_t size) { return AllocateMemory(size); }
+void operator delete(void* memory) noexcept { FreeMemory(memory); }
+void operator delete[](void* memory) noexcept { FreeMemory(memory); }
+void operator delete(void* memory, size_t) noexcept { FreeMemory(memory); }
+void operator delete[](void* memory, size_t) noexcept { FreeMemory(memory); }
+
+void charge_to_interning(const void* memory)
+{
+    allocationTable.Recharge(memory, AllocationSubsystem::Interning);
+}
+
+void report_allocations(std::ostream& stream)
+{
+    AllocationTotals totals[AllocationTable::numTotals];
+    allocationTable.GetTotals(totals);
+
+    char line[160];
+    snprintf(line, sizeof(line), "%-20s %14s %16s %16s %16s\n", "subsystem", "allocations", "bytes", "peak live bytes", "live at exit");
+    std::string table = line;
+    for (int subsystem = 0; subsystem < AllocationTable::numTotals; subsystem++)
+    {
+        const AllocationTotals& total = totals[subsystem];
+        if (total.m_allocations == 0 && subsystem + 1 < AllocationTable::numTotals) continue;
+
+        // the peak of the whole program is when the sum was largest, not the sum of the peaks above
+        snprintf(line, sizeof(line), "%-20s %14lld %16lld %16lld %16lld\n",
+            subsystem + 1 < AllocationTable::numTotals ? allocationSubsystemNames[subsystem] : "total",
+            static_cast<long long>(total.m_allocations), static_cast<long long>(total.m_bytes),
+            static_cast<long long>(total.m_peakLiveBytes), static_cast<long long>(total.m_liveBytes));
+        table += line;
+    }
+    stream << table << std::flush;
+}
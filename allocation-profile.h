@@ -0,0 +1,49 @@
+#ifndef ALLOCATION_PROFILE_H_
+#define ALLOCATION_PROFILE_H_
+
+// The allocation profile (-A). allocation-profile.cc replaces the global operator new and delete for the whole
+// program. Without -A they test the flag once and go straight to malloc and free; with it every block is charged
+// to a subsystem until it is deleted.
+
+#include <iosfwd>
+
+extern int semant_allocation_profile;
+
+// Where -A charges the memory the checker allocates with new. An allocation goes to the subsystem of the thread
+// that made it, which is set by the running phase, see PhaseTimer, or an AllocationScope.
+enum class AllocationSubsystem : unsigned char
+{
+  Other,
+  Interning,       // string table entries and their text
+  AstConstruction, // the tree built by the parser, the basic classes and the interfaces
+  Hierarchy,       // inheritance nodes and the class map
+  MethodTables,
+  TypeEnvironment, // symbol tables, attribute environments and everything checking an expression allocates
+  Output,          // the typed AST writer and diagnostics
+  NumSubsystems
+};
+
+// Returns the subsystem that was current before
+AllocationSubsystem set_allocation_subsystem(AllocationSubsystem subsystem);
+
+class AllocationScope
+{
+public:
+  explicit AllocationScope(AllocationSubsystem subsystem) : m_active(semant_allocation_profile != 0)
+  {
+    if (m_active) m_previous = set_allocation_subsystem(subsystem);
+  }
+  ~AllocationScope() { if (m_active) set_allocation_subsystem(m_previous); }
+
+private:
+  bool m_active;
+  AllocationSubsystem m_previous = AllocationSubsystem::Other;
+};
+
+// Charges a block made with new to interning whatever subsystem made it, for the string table's entries and text
+void charge_to_interning(const void* memory);
+
+// Prints allocations, bytes, peak live bytes and bytes still live for every subsystem
+void report_allocations(std::ostream& stream);
+
+#endif
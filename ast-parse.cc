@@ -154,6 +154,7 @@
 /* Copy the first part of user declarations.  */
 #line 6 "ast.y"
 
+#include <string>
 #include "cool-io.h"
 #include "cool-tree.h"
 #include "stringtab.h"
@@ -166,6 +167,7 @@ Program ast_root;             /* the result of the parse  */
 Classes parse_results;        /* for use in parsing multiple files */
 int omerrs = 0;               /* number of errors in lexing and parsing */
 int current_line = 0;         /* debugging, current line for input file */
+std::string ast_parse_error;  /* why the last parse failed, empty if it did not */
 
 
 /* Enabling traces.  */
@@ -1518,7 +1520,7 @@ yyreduce:
 
   case 3:
 #line 72 "ast.y"
-    { exit(1); }
+    { ast_yyerror((char *) "no program"); ast_root = NULL; YYABORT; }
     break;
 
   case 4:
@@ -1989,11 +1991,11 @@ yyreturn:
 #line 243 "ast.y"
 
 
+/* Only the first error is kept, the caller reports it once the parse has failed */
 void ast_yyerror(char *msg)
 {
-   cerr << "Error in ast parsing (line " << current_line << "): ";
-   cerr << msg << endl;
-   exit(1);
+   if (!ast_parse_error.empty()) return;
+   ast_parse_error = "Error in ast parsing (line " + std::to_string(current_line) + "): " + msg + "\n";
 }
 
 
@@ -0,0 +1,106 @@
+#include "check-cost.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct CheckCostRecord
+{
+    std::string m_filename;
+    std::string m_className;
+    std::string m_featureName; // empty for the totals of a class
+    int m_line;
+    int m_classLine;
+    CheckCost m_cost;
+};
+
+static std::mutex checkCostMutex;
+static std::vector<CheckCostRecord> featureCosts;
+
+void record_check_cost(Class_ currentClass, Feature feature, const CheckCost& cost)
+{
+    CheckCostRecord record { currentClass->get_filename()->get_string(), currentClass->get_name()->get_string(),
+        feature->get_name()->get_string(), feature->get_line_number(), currentClass->get_line_number(), cost };
+    std::lock_guard<std::mutex> lock(checkCostMutex);
+    featureCosts.push_back(std::move(record));
+}
+
+// The features and the per class totals, each sorted by time with the most expensive first. A class checked in
+// several programs, as in batch mode, is counted once per file.
+static void RankCheckCosts(std::vector<CheckCostRecord>& classes, std::vector<CheckCostRecord>& features)
+{
+    std::lock_guard<std::mutex> lock(checkCostMutex);
+    features = featureCosts;
+
+    std::map<std::pair<std::string, std::string>, size_t> classIndices;
+    for (const CheckCostRecord& feature : features)
+    {
+        auto inserted = classIndices.emplace(std::make_pair(feature.m_filename, feature.m_className), classes.size());
+        if (inserted.second)
+        {
+            classes.push_back(CheckCostRecord { feature.m_filename, feature.m_className, "", feature.m_classLine, feature.m_classLine, CheckCost() });
+        }
+        classes[inserted.first->second].m_cost.Add(feature.m_cost);
+    }
+
+    auto moreExpensive = [](const CheckCostRecord& a, const CheckCostRecord& b) {
+        return a.m_cost.m_nanoseconds > b.m_cost.m_nanoseconds;
+    };
+    std::stable_sort(classes.begin(), classes.end(), moreExpensive);
+    std::stable_sort(features.begin(), features.end(), moreExpensive);
+}
+
+void report_check_costs(ostream& stream, int numEntries)
+{
+    std::vector<CheckCostRecord> classes, features;
+    RankCheckCosts(classes, features);
+
+    char line[256];
+    std::string table;
+    for (int ranking = 0; ranking < 2; ranking++)
+    {
+        const std::vector<CheckCostRecord>& records = ranking == 0 ? classes : features;
+        snprintf(line, sizeof(line), "%-40s %12s %12s %12s %12s\n", ranking == 0 ? "class" : "feature",
+            "time (ms)", "expressions", "lookups", "conformance");
+        table += line;
+        for (size_t i = 0; i < records.size() && static_cast<int>(i) < numEntries; i++)
+        {
+            const CheckCostRecord& record = records[i];
+            std::string name = record.m_className;
+            if (ranking == 1) name += "." + record.m_featureName + " (" + record.m_filename + ":" + std::to_string(record.m_line) + ")";
+            snprintf(line, sizeof(line), "%-40s %12.3f %12lld %12lld %12lld\n", name.c_str(), record.m_cost.m_nanoseconds / 1e6,
+                static_cast<long long>(record.m_cost.m_expressions), static_cast<long long>(record.m_cost.m_symbolLookups),
+                static_cast<long long>(record.m_cost.m_conformanceChecks));
+            table += line;
+        }
+        if (ranking == 0) table += "\n";
+    }
+    stream << table << std::flush;
+}
+
+bool write_check_costs(const char* path)
+{
+    std::vector<CheckCostRecord> classes, features;
+    RankCheckCosts(classes, features);
+
+    std::ofstream file(path);
+    file << "kind,class,feature,file,line,time_ms,expressions,lookups,conformance\n";
+    for (int ranking = 0; ranking < 2; ranking++)
+    {
+        for (const CheckCostRecord& record : ranking == 0 ? classes : features)
+        {
+            // names can't contain commas or quotes, the file name is quoted in case it does
+            std::string filename;
+            for (char c : record.m_filename) filename += c == '"' ? std::string("\"\"") : std::string(1, c);
+            file << (ranking == 0 ? "class" : "feature") << "," << record.m_className << "," << record.m_featureName
+                 << ",\"" << filename << "\"," << record.m_line << "," << std::fixed << std::setprecision(3)
+                 << record.m_cost.m_nanoseconds / 1e6 << "," << record.m_cost.m_expressions << ","
+                 << record.m_cost.m_symbolLookups << "," << record.m_cost.m_conformanceChecks << "\n";
+        }
+    }
+    return static_cast<bool>(file.flush());
+}
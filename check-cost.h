@@ -0,0 +1,35 @@
+#ifndef CHECK_COST_H_
+#define CHECK_COST_H_
+
+// The per feature check costs that -K ranks and -F writes out, kept in check-cost.cc
+
+#include <stdint.h>
+#include "cool-tree.h"
+
+// Work done checking one feature, or all the features of a class, for the -K cost ranking
+struct CheckCost
+{
+  int64_t m_nanoseconds = 0;
+  int64_t m_expressions = 0;
+  int64_t m_symbolLookups = 0;      // identifiers and the methods probed while resolving a dispatch
+  int64_t m_conformanceChecks = 0;  // IsClassChildOfClassOrEqual calls
+
+  void Add(const CheckCost& other)
+  {
+    m_nanoseconds += other.m_nanoseconds;
+    m_expressions += other.m_expressions;
+    m_symbolLookups += other.m_symbolLookups;
+    m_conformanceChecks += other.m_conformanceChecks;
+  }
+};
+
+// Keeps the cost of one checked feature for the ranking below, callable from any thread
+void record_check_cost(Class_ currentClass, Feature feature, const CheckCost& cost);
+
+// Prints the numEntries most expensive classes and features by check time
+void report_check_costs(ostream& stream, int numEntries);
+
+// Writes the cost of every class and feature as CSV, most expensive first
+bool write_check_costs(const char* path);
+
+#endif
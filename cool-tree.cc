@@ -433,229 +433,229 @@ void object_class::dump(ostream& stream, int n)
 }
 
 
-// interfaces used by Bison
+// interfaces used by Bison, the nodes come from the current AstPool if there is one
 Classes nil_Classes()
 {
-   return new nil_node<Class_>();
+   return new (AstPool::GetCurrent()) nil_node<Class_>();
 }
 
 Classes single_Classes(Class_ e)
 {
-   return new single_list_node<Class_>(e);
+   return new (AstPool::GetCurrent()) single_list_node<Class_>(e);
 }
 
 Classes append_Classes(Classes p1, Classes p2)
 {
-   return new append_node<Class_>(p1, p2);
+   return new (AstPool::GetCurrent()) append_node<Class_>(p1, p2);
 }
 
 Features nil_Features()
 {
-   return new nil_node<Feature>();
+   return new (AstPool::GetCurrent()) nil_node<Feature>();
 }
 
 Features single_Features(Feature e)
 {
-   return new single_list_node<Feature>(e);
+   return new (AstPool::GetCurrent()) single_list_node<Feature>(e);
 }
 
 Features append_Features(Features p1, Features p2)
 {
-   return new append_node<Feature>(p1, p2);
+   return new (AstPool::GetCurrent()) append_node<Feature>(p1, p2);
 }
 
 Formals nil_Formals()
 {
-   return new nil_node<Formal>();
+   return new (AstPool::GetCurrent()) nil_node<Formal>();
 }
 
 Formals single_Formals(Formal e)
 {
-   return new single_list_node<Formal>(e);
+   return new (AstPool::GetCurrent()) single_list_node<Formal>(e);
 }
 
 Formals append_Formals(Formals p1, Formals p2)
 {
-   return new append_node<Formal>(p1, p2);
+   return new (AstPool::GetCurrent()) append_node<Formal>(p1, p2);
 }
 
 Expressions nil_Expressions()
 {
-   return new nil_node<Expression>();
+   return new (AstPool::GetCurrent()) nil_node<Expression>();
 }
 
 Expressions single_Expressions(Expression e)
 {
-   return new single_list_node<Expression>(e);
+   return new (AstPool::GetCurrent()) single_list_node<Expression>(e);
 }
 
 Expressions append_Expressions(Expressions p1, Expressions p2)
 {
-   return new append_node<Expression>(p1, p2);
+   return new (AstPool::GetCurrent()) append_node<Expression>(p1, p2);
 }
 
 Cases nil_Cases()
 {
-   return new nil_node<Case>();
+   return new (AstPool::GetCurrent()) nil_node<Case>();
 }
 
 Cases single_Cases(Case e)
 {
-   return new single_list_node<Case>(e);
+   return new (AstPool::GetCurrent()) single_list_node<Case>(e);
 }
 
 Cases append_Cases(Cases p1, Cases p2)
 {
-   return new append_node<Case>(p1, p2);
+   return new (AstPool::GetCurrent()) append_node<Case>(p1, p2);
 }
 
 Program program(Classes classes)
 {
-  return new program_class(classes);
+  return new (AstPool::GetCurrent()) program_class(classes);
 }
 
 Class_ class_(Symbol name, Symbol parent, Features features, Symbol filename)
 {
-  return new class__class(name, parent, features, filename);
+  return new (AstPool::GetCurrent()) class__class(name, parent, features, filename);
 }
 
 Feature method(Symbol name, Formals formals, Symbol return_type, Expression expr)
 {
-  return new method_class(name, formals, return_type, expr);
+  return new (AstPool::GetCurrent()) method_class(name, formals, return_type, expr);
 }
 
 Feature attr(Symbol name, Symbol type_decl, Expression init)
 {
-  return new attr_class(name, type_decl, init);
+  return new (AstPool::GetCurrent()) attr_class(name, type_decl, init);
 }
 
 Formal formal(Symbol name, Symbol type_decl)
 {
-  return new formal_class(name, type_decl);
+  return new (AstPool::GetCurrent()) formal_class(name, type_decl);
 }
 
 Case branch(Symbol name, Symbol type_decl, Expression expr)
 {
-  return new branch_class(name, type_decl, expr);
+  return new (AstPool::GetCurrent()) branch_class(name, type_decl, expr);
 }
 
 Expression assign(Symbol name, Expression expr)
 {
-  return new assign_class(name, expr);
+  return new (AstPool::GetCurrent()) assign_class(name, expr);
 }
 
 Expression static_dispatch(Expression expr, Symbol type_name, Symbol name, Expressions actual)
 {
-  return new static_dispatch_class(expr, type_name, name, actual);
+  return new (AstPool::GetCurrent()) static_dispatch_class(expr, type_name, name, actual);
 }
 
 Expression dispatch(Expression expr, Symbol name, Expressions actual)
 {
-  return new dispatch_class(expr, name, actual);
+  return new (AstPool::GetCurrent()) dispatch_class(expr, name, actual);
 }
 
 Expression cond(Expression pred, Expression then_exp, Expression else_exp)
 {
-  return new cond_class(pred, then_exp, else_exp);
+  return new (AstPool::GetCurrent()) cond_class(pred, then_exp, else_exp);
 }
 
 Expression loop(Expression pred, Expression body)
 {
-  return new loop_class(pred, body);
+  return new (AstPool::GetCurrent()) loop_class(pred, body);
 }
 
 Expression typcase(Expression expr, Cases cases)
 {
-  return new typcase_class(expr, cases);
+  return new (AstPool::GetCurrent()) typcase_class(expr, cases);
 }
 
 Expression block(Expressions body)
 {
-  return new block_class(body);
+  return new (AstPool::GetCurrent()) block_class(body);
 }
 
 Expression let(Symbol identifier, Symbol type_decl, Expression init, Expression body)
 {
-  return new let_class(identifier, type_decl, init, body);
+  return new (AstPool::GetCurrent()) let_class(identifier, type_decl, init, body);
 }
 
 Expression plus(Expression e1, Expression e2)
 {
-  return new plus_class(e1, e2);
+  return new (AstPool::GetCurrent()) plus_class(e1, e2);
 }
 
 Expression sub(Expression e1, Expression e2)
 {
-  return new sub_class(e1, e2);
+  return new (AstPool::GetCurrent()) sub_class(e1, e2);
 }
 
 Expression mul(Expression e1, Expression e2)
 {
-  return new mul_class(e1, e2);
+  return new (AstPool::GetCurrent()) mul_class(e1, e2);
 }
 
 Expression divide(Expression e1, Expression e2)
 {
-  return new divide_class(e1, e2);
+  return new (AstPool::GetCurrent()) divide_class(e1, e2);
 }
 
 Expression neg(Expression e1)
 {
-  return new neg_class(e1);
+  return new (AstPool::GetCurrent()) neg_class(e1);
 }
 
 Expression lt(Expression e1, Expression e2)
 {
-  return new lt_class(e1, e2);
+  return new (AstPool::GetCurrent()) lt_class(e1, e2);
 }
 
 Expression eq(Expression e1, Expression e2)
 {
-  return new eq_class(e1, e2);
+  return new (AstPool::GetCurrent()) eq_class(e1, e2);
 }
 
 Expression leq(Expression e1, Expression e2)
 {
-  return new leq_class(e1, e2);
+  return new (AstPool::GetCurrent()) leq_class(e1, e2);
 }
 
 Expression comp(Expression e1)
 {
-  return new comp_class(e1);
+  return new (AstPool::GetCurrent()) comp_class(e1);
 }
 
 Expression int_const(Symbol token)
 {
-  return new int_const_class(token);
+  return new (AstPool::GetCurrent()) int_const_class(token);
 }
 
 Expression bool_const(Boolean val)
 {
-  return new bool_const_class(val);
+  return new (AstPool::GetCurrent()) bool_const_class(val);
 }
 
 Expression string_const(Symbol token)
 {
-  return new string_const_class(token);
+  return new (AstPool::GetCurrent()) string_const_class(token);
 }
 
 Expression new_(Symbol type_name)
 {
-  return new new__class(type_name);
+  return new (AstPool::GetCurrent()) new__class(type_name);
 }
 
 Expression isvoid(Expression e1)
 {
-  return new isvoid_class(e1);
+  return new (AstPool::GetCurrent()) isvoid_class(e1);
 }
 
 Expression no_expr()
 {
-  return new no_expr_class();
+  return new (AstPool::GetCurrent()) no_expr_class();
 }
 
 Expression object(Symbol name)
 {
-  return new object_class(name);
+  return new (AstPool::GetCurrent()) object_class(name);
 }
 
@@ -5,6 +5,8 @@
 #define COOL_TREE_HANDCODE_H
 
 #include <iostream>
+#include <vector>
+#include <stdint.h>
 #include "tree.h"
 #include "cool.h"
 #include "stringtab.h"
@@ -44,6 +46,47 @@ typedef Expressions_class *Expressions;
 typedef list_node<Case> Cases_class;
 typedef Cases_class *Cases;
 
+// Memory for the nodes the constructor functions in cool-tree.cc build. The tree package never frees a node, so
+// without a current pool nodes come from the heap and last as long as the process. A caller that checks many
+// programs in one process, like the server, makes a pool current while it parses and checks one program and
+// then frees the whole tree at once with the pool. Nodes are not destroyed one by one, none of them owns memory.
+class AstPool {
+public:
+	AstPool() {}
+	~AstPool();
+
+	void* Allocate(size_t size);
+
+	static AstPool* GetCurrent() { return current; }
+
+	// Makes pool, or no pool for NULL, current on the calling thread until the end of the scope
+	class Scope {
+	public:
+		explicit Scope(AstPool* pool) : m_previous(current) { current = pool; }
+		~Scope() { current = m_previous; }
+
+	private:
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+		AstPool* m_previous;
+	};
+
+private:
+	AstPool(const AstPool&) = delete;
+	AstPool& operator=(const AstPool&) = delete;
+
+	static const size_t blockSize = 1 << 16;
+	static thread_local AstPool* current;
+
+	std::vector<char*> m_blocks;
+	size_t m_used = blockSize;	// bytes handed out from the last block
+};
+
+// From pool, or from the heap if pool is NULL
+void* operator new(size_t size, AstPool* pool);
+void operator delete(void* memory, AstPool* pool);	// only called if a constructor throws
+
 enum class ExpressionType : unsigned char {
 	Assign,
 	StaticDispatch,
@@ -71,19 +114,183 @@ enum class ExpressionType : unsigned char {
     Object
 };
 
+// What an identifier was resolved to during semantic analysis, recorded on the node so that
+// later passes can address the variable directly instead of looking the name up again
+enum class BindingKind : unsigned char {
+	Unresolved,
+	Self,
+	Attribute,	// index is the attribute's offset in the class layout, ancestors' attributes first
+	Formal,		// index is the formal's position in the method signature
+	Local		// index is the let/case variable's slot in the feature's frame
+};
+
+struct Binding {
+	BindingKind kind = BindingKind::Unresolved;
+	int index = -1;
+};
+
+// Writes the typed AST through one large buffer that is handed to a file descriptor or appended to a string
+// when it fills, rather than going through an ostream a token at a time. The output is byte for byte what
+// dump_with_types(ostream&, int) prints, except that compact mode leaves out the indentation.
+class TypedAstWriter {
+public:
+	explicit TypedAstWriter(int fd, bool compact = false);
+	explicit TypedAstWriter(std::string& output, bool compact = false);
+	~TypedAstWriter();
+
+	void WriteLineNumber(int n, int line);
+	void WriteLine(int n, const char* text);	// text must not need escaping
+	void WriteSymbol(int n, Symbol symbol);
+	void WriteBoolean(int n, Boolean b);
+	void WriteString(int n, const char* s);		// quoted and escaped like print_escaped_string
+	void WriteType(int n, Symbol type);
+	void WriteType(int n, const char* type);	// NULL for no type
+
+	// Hands over everything buffered so far, false once a write to the file descriptor has failed
+	bool Flush();
+
+	size_t GetNumBytes() const { return m_flushed + m_used; }	// written so far, buffered or not
+
+private:
+	TypedAstWriter(const TypedAstWriter&) = delete;
+	TypedAstWriter& operator=(const TypedAstWriter&) = delete;
+
+	void Indent(int n);
+	void Append(const char* bytes, size_t length);
+	void AppendNumber(int number);
+
+	static const size_t bufferSize = 1 << 18;
+
+	int m_fd;
+	std::string* m_output;
+	bool m_compact;
+	bool m_failed = false;
+	char* m_buffer;
+	size_t m_used = 0;
+	size_t m_flushed = 0;
+};
+
+// Binary form of the typed AST, laid out so that a later stage can read or mmap the whole file and use it in
+// place. The file is a BinaryAstHeader followed by numNodes BinaryAstNodes in pre-order (node 0 is the program),
+// numChildren uint32_t node indices, numSymbols uint32_t offsets into the string pool and stringBytes bytes of
+// NUL terminated strings. All fields are in host byte order. Version 2 added the bindings and frame sizes the
+// checker resolves, so a later stage can address variables without looking their names up again.
+enum class BinaryAstKind : uint8_t {
+	Program,
+	Class,
+	Method,
+	Attr,
+	Formal,
+	Branch,
+	FirstExpression	// followed by one kind per ExpressionType, in the same order
+};
+
+struct BinaryAstHeader {
+	char magic[8];			// "COOLTAST"
+	uint32_t version;
+	uint32_t numNodes;
+	uint32_t numChildren;
+	uint32_t numSymbols;
+	uint32_t stringBytes;
+	uint32_t reserved;
+};
+
+// The operands are symbol indices, or -1 where unused:
+//   Class        name, parent, filename         children: features
+//   Method       name, return type              children: formals, then the body
+//   Attr         name, type                     children: init
+//   Formal       name, type
+//   Branch       name, type                     children: body
+//   Assign       name                           children: expression
+//   StaticDispatch  type, method name           children: object, then the actuals
+//   Dispatch     method name                    children: object, then the actuals
+//   Let          identifier, type               children: init, body
+//   IntConst, StringConst  token;  New  type;  Object  name
+//   BoolConst    operand 0 is the value itself
+// The remaining expressions only have children, in the order dump_with_types prints them.
+struct BinaryAstNode {
+	uint8_t kind;			// a BinaryAstKind
+	uint8_t bindingKind;	// a BindingKind, what an Object or Assign names; Unresolved for other kinds
+	uint8_t reserved[2];
+	int32_t line;
+	int32_t type;			// symbol index of an expression's type, -1 if it has none
+	int32_t operands[3];
+	uint32_t firstChild;	// index of the first child in the children array
+	uint32_t numChildren;
+	int32_t bindingIndex;	// Binding::index of an Object or Assign, -1 for other kinds
+	int32_t localSlots;		// let/case frame slots a Method or Attr body needs, 0 for other kinds
+};
+
+// Encodes a checked program in the binary form
+void dump_binary_with_types(Program program, std::string& output);
+
+// The listing -L prints instead of the typed AST: a line per feature with its frame size and a line per use of
+// a variable with what it resolved to. The same lines are written for a checked program and for a decoded
+// binary typed AST, so the two can be compared.
+void write_feature_slots(ostream& stream, int line, const char* className, const char* featureName, int localSlots);
+void write_binding(ostream& stream, int line, const char* name, Binding binding);
+
+// Read only view of a binary typed AST, either mapped from a file or over bytes held by the caller
+class BinaryAst {
+public:
+	BinaryAst() {}
+	~BinaryAst();
+
+	bool Load(const char* path);	// false if the file can't be mapped or isn't a valid binary typed AST
+	bool Load(const char* bytes, size_t length);
+
+	uint32_t GetNumNodes() const { return m_header->numNodes; }
+	const BinaryAstNode& GetNode(uint32_t index) const { return m_nodes[index]; }
+	uint32_t GetChild(const BinaryAstNode& node, uint32_t i) const { return m_children[node.firstChild + i]; }
+	const char* GetSymbol(int32_t index) const { return index < 0 ? NULL : m_strings + m_symbolOffsets[index]; }
+
+	// Prints the tree exactly as dump_with_types prints the program it was encoded from
+	void DumpWithTypes(TypedAstWriter& writer) const;
+
+	// Prints the -L listing of the program it was encoded from
+	void WriteBindings(ostream& stream) const;
+
+private:
+	BinaryAst(const BinaryAst&) = delete;
+	BinaryAst& operator=(const BinaryAst&) = delete;
+
+	// A node being printed, see DumpWithTypes
+	struct DumpFrame {
+		uint32_t index;
+		int n;			// indentation
+		uint32_t child;		// the next child to print
+		bool middleWritten;	// whether the text between the first and the last children has been printed
+	};
+
+	int64_t ResumeDump(TypedAstWriter& writer, DumpFrame& frame) const;
+
+	void* m_mapping = NULL;
+	size_t m_mappingLength = 0;
+	const BinaryAstHeader* m_header = NULL;
+	const BinaryAstNode* m_nodes = NULL;
+	const uint32_t* m_children = NULL;
+	const uint32_t* m_symbolOffsets = NULL;
+	const char* m_strings = NULL;
+};
+
 #define Program_EXTRAS                          \
 virtual void semant() = 0;			\
-virtual void dump_with_types(ostream&, int) = 0; 
+virtual Classes get_classes() = 0; \
+virtual void dump_with_types(ostream&, int) = 0; \
+virtual void dump_with_types(TypedAstWriter&, int) = 0; 
 
 
 
 #define program_EXTRAS                          \
 void semant();     				\
-void dump_with_types(ostream&, int);            
+Classes get_classes() { return classes; } \
+void dump_with_types(ostream&, int);            \
+void dump_with_types(TypedAstWriter&, int);
 
 #define Class__EXTRAS                   \
 virtual Symbol get_filename() = 0;      \
 virtual void dump_with_types(ostream&,int) = 0; \
+virtual void dump_with_types(TypedAstWriter&,int) = 0; \
 virtual Symbol get_parent() = 0;                 \
 virtual Symbol get_name() = 0;					\
 virtual Features get_features() = 0;
@@ -92,16 +299,22 @@ virtual Features get_features() = 0;
 #define class__EXTRAS                                 \
 Symbol get_filename() { return filename; }             \
 void dump_with_types(ostream&,int);                     \
+void dump_with_types(TypedAstWriter&,int);              \
 Symbol get_parent() { return parent; }                   \
 Symbol get_name() { return name; }						\
 Features get_features() { return features; }			
 
+// local_slots is the number of let/case frame slots the feature body needs
 #define Feature_EXTRAS                                        \
 virtual void dump_with_types(ostream&,int) = 0; \
+virtual void dump_with_types(TypedAstWriter&,int) = 0; \
 virtual bool is_attr() = 0;	\
 virtual Symbol get_name() = 0;	\
 virtual Symbol get_type() = 0; \
-virtual Expression get_expression() = 0;
+virtual Expression get_expression() = 0; \
+int local_slots = 0; \
+int get_local_slots() { return local_slots; } \
+void set_local_slots(int n) { local_slots = n; }
 
 #define attr_EXTRAS \
 bool is_attr() { return true; }	\
@@ -117,7 +330,8 @@ Expression get_expression() { return expr; }  \
 Formals get_formals() { return formals; };
 
 #define Feature_SHARED_EXTRAS                                       \
-void dump_with_types(ostream&,int);    
+void dump_with_types(ostream&,int);    \
+void dump_with_types(TypedAstWriter&,int);
 
 #define Formal_EXTRAS                              \
 virtual void dump_with_types(ostream&,int) = 0; \
@@ -158,7 +372,10 @@ virtual ExpressionType get_expr_type() = 0;	\
 #define assign_EXTRAS	\
 ExpressionType get_expr_type() { return ExpressionType::Assign; }	\
 Symbol get_symbol_name() { return name; }	\
-Expression get_expr() { return expr; }
+Expression get_expr() { return expr; }	\
+Binding binding;	\
+Binding get_binding() { return binding; }	\
+void set_binding(Binding b) { binding = b; }
 
 #define static_dispatch_EXTRAS	\
 ExpressionType get_expr_type() { return ExpressionType::StaticDispatch; }	\
@@ -244,13 +461,16 @@ ExpressionType get_expr_type() { return ExpressionType::Comp; } \
 Expression get_rhs() { return e1; } \
 
 #define int_const_EXTRAS	\
-ExpressionType get_expr_type() { return ExpressionType::IntConst; }
+ExpressionType get_expr_type() { return ExpressionType::IntConst; }	\
+Symbol get_token() { return token; }
 
 #define bool_const_EXTRAS	\
-ExpressionType get_expr_type() { return ExpressionType::BoolConst; }
+ExpressionType get_expr_type() { return ExpressionType::BoolConst; }	\
+Boolean get_val() { return val; }
 
 #define string_const_EXTRAS	\
-ExpressionType get_expr_type() { return ExpressionType::StringConst; }
+ExpressionType get_expr_type() { return ExpressionType::StringConst; }	\
+Symbol get_token() { return token; }
 
 #define new__EXTRAS	\
 ExpressionType get_expr_type() { return ExpressionType::New; } \
@@ -265,7 +485,10 @@ ExpressionType get_expr_type() { return ExpressionType::NoExpr; }
 
 #define object_EXTRAS	\
 ExpressionType get_expr_type() { return ExpressionType::Object; }	\
-Symbol get_name() { return name; }
+Symbol get_name() { return name; }	\
+Binding binding;	\
+Binding get_binding() { return binding; }	\
+void set_binding(Binding b) { binding = b; }
 
 #define Expression_SHARED_EXTRAS           \
 void dump_with_types(ostream&,int); 
@@ -0,0 +1,114 @@
+#include "counters.h"
+
+#include <mutex>
+#include <set>
+#include <string>
+
+// Indexed by ExpressionType, the names dump uses for the node kinds
+static const char* expressionKindNames[] = {
+    "assign", "static_dispatch", "dispatch", "cond", "loop", "typcase", "block", "let", "plus", "sub", "mul",
+    "divide", "neg", "lt", "eq", "leq", "comp", "int_const", "bool_const", "string_const", "new_", "isvoid",
+    "no_expr", "object"
+};
+static_assert(sizeof(expressionKindNames) / sizeof(expressionKindNames[0]) == numExpressionTypes,
+    "expressionKindNames must have one name per ExpressionType");
+
+const char* expression_kind_name(ExpressionType type)
+{
+    return expressionKindNames[static_cast<int>(type)];
+}
+
+static const char* counterNames[] =
+{
+    "stringtab.interns",
+    "stringtab.probes",
+    "symtab.lookups",
+    "symtab.scope_pushes",
+    "methodmap.lookups",
+    "conformance.calls",
+    "common_ancestor.calls",
+    "string.temporaries"
+};
+static_assert(sizeof(counterNames) / sizeof(counterNames[0]) == static_cast<size_t>(HotCounter::NumCounters),
+    "counterNames must have one name per HotCounter");
+
+// The blocks of the threads still running, and the sums of those that have ended. Never freed, as threads can end
+// while the process exits and static destruction has already started.
+struct CounterRegistry
+{
+    std::mutex m_mutex;
+    std::set<const ThreadCounters*> m_live;
+    ThreadCounters m_retired;
+};
+
+static CounterRegistry& GetCounterRegistry()
+{
+    static CounterRegistry* registry = new CounterRegistry();
+    return *registry;
+}
+
+static void AddCounters(ThreadCounters& total, const ThreadCounters& counters)
+{
+    for (int i = 0; i < static_cast<int>(HotCounter::NumCounters); i++) total.m_counts[i] += counters.m_counts[i];
+    for (int i = 0; i < numExpressionTypes; i++) total.m_expressions[i] += counters.m_expressions[i];
+}
+
+// A thread's block, in the registry for as long as the thread runs
+struct RegisteredCounters
+{
+    RegisteredCounters()
+    {
+        CounterRegistry& registry = GetCounterRegistry();
+        std::lock_guard<std::mutex> lock(registry.m_mutex);
+        registry.m_live.insert(&m_counters);
+    }
+
+    ~RegisteredCounters()
+    {
+        CounterRegistry& registry = GetCounterRegistry();
+        std::lock_guard<std::mutex> lock(registry.m_mutex);
+        registry.m_live.erase(&m_counters);
+        AddCounters(registry.m_retired, m_counters);
+    }
+
+    ThreadCounters m_counters;
+};
+
+ThreadCounters& thread_counters()
+{
+    thread_local RegisteredCounters counters;
+    return counters.m_counters;
+}
+
+void dump_counters(ostream& stream)
+{
+    ThreadCounters total;
+    CounterRegistry& registry = GetCounterRegistry();
+    {
+        std::lock_guard<std::mutex> lock(registry.m_mutex);
+        AddCounters(total, registry.m_retired);
+        for (const ThreadCounters* counters : registry.m_live) AddCounters(total, *counters);
+    }
+
+    std::string text = "# cool-semant counters 1\n";
+    for (int i = 0; i < static_cast<int>(HotCounter::NumCounters); i++)
+    {
+        text += std::string(counterNames[i]) + " " + std::to_string(total.m_counts[i]) + "\n";
+    }
+    for (int i = 0; i < numExpressionTypes; i++)
+    {
+        text += std::string("ast.") + expressionKindNames[i] + " " + std::to_string(total.m_expressions[i]) + "\n";
+    }
+    stream << text << std::flush;
+}
+
+// Called from stringtab.cc
+void count_string_intern()
+{
+    count_event(HotCounter::StringInterns);
+}
+
+void count_string_probe()
+{
+    count_event(HotCounter::StringProbes);
+}
@@ -0,0 +1,58 @@
+#ifndef COUNTERS_H_
+#define COUNTERS_H_
+
+// The operation counters (-U), kept in counters.cc. The string tables include this header for their own two counts.
+
+#include <stdint.h>
+#include "cool-tree.h"
+
+extern int semant_counters;
+
+// Operation counts that -U dumps. Unlike times they are the same from run to run, so a diff of two dumps shows
+// an algorithmic change that timing noise would hide. New counters go at the end to keep the dump stable.
+enum class HotCounter : unsigned char
+{
+  StringInterns,       // entries added to the string tables
+  StringProbes,        // entries compared while looking a string up in a string table
+  SymbolLookups,       // lookups in the scoped symbol tables
+  ScopePushes,
+  MethodMapLookups,
+  ConformanceChecks,   // IsClassChildOfClassOrEqual calls
+  CommonAncestorCalls, // FirstCommonAncestor calls
+  StringTemporaries,   // std::strings the checker builds from symbols to use as keys
+  NumCounters
+};
+
+static const int numExpressionTypes = static_cast<int>(ExpressionType::Object) + 1;
+
+// The name dump uses for the node kind, as in the counter names and query replies
+const char* expression_kind_name(ExpressionType type);
+
+// Every thread counts into its own block, which is merged into the process totals when the thread ends
+struct ThreadCounters
+{
+  int64_t m_counts[static_cast<int>(HotCounter::NumCounters)] = {};
+  int64_t m_expressions[numExpressionTypes] = {}; // expression nodes checked, by kind
+};
+
+ThreadCounters& thread_counters();
+
+// Without -U a count is a flag test and nothing else
+inline void count_event(HotCounter counter, int64_t n = 1)
+{
+  if (semant_counters) thread_counters().m_counts[static_cast<int>(counter)] += n;
+}
+
+inline void count_expression(ExpressionType type)
+{
+  if (semant_counters) thread_counters().m_expressions[static_cast<int>(type)]++;
+}
+
+// Writes the totals of every thread, finished or not, one "name value" line per counter in a fixed order
+void dump_counters(ostream& stream);
+
+// The string tables' two counts, stringtab.cc only calls these with -U
+void count_string_intern();
+void count_string_probe();
+
+#endif
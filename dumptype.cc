@@ -4,6 +4,16 @@
 //
 #include "copyright.h"
 
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "cool.h"
 #include "tree.h"
 #include "cool-tree.h"
@@ -118,6 +128,164 @@ void Expression_class::dump_type(ostream& stream, int n)
     { stream << pad(n) << ": _no_type" << endl; }
 }
 
+//
+//  TypedAstWriter collects the same text as the ostream traversal in a
+//  buffer of bufferSize bytes and only hands it to the file descriptor
+//  or string when the buffer fills or on Flush, so a large program goes
+//  out in a handful of write calls.  Indentation is copied from the
+//  same 80 blank padding string that pad uses.
+//
+
+TypedAstWriter::TypedAstWriter(int fd, bool compact)
+  : m_fd(fd), m_output(NULL), m_compact(compact), m_buffer(new char[bufferSize]) { }
+
+TypedAstWriter::TypedAstWriter(std::string& output, bool compact)
+  : m_fd(-1), m_output(&output), m_compact(compact), m_buffer(new char[bufferSize]) { }
+
+TypedAstWriter::~TypedAstWriter()
+{
+  Flush();
+  delete[] m_buffer;
+}
+
+bool TypedAstWriter::Flush()
+{
+  if (m_output != NULL) {
+    m_output->append(m_buffer, m_used);
+  } else {
+    const char *bytes = m_buffer;
+    size_t length = m_used;
+    while (length > 0 && !m_failed) {
+      ssize_t written = write(m_fd, bytes, length);
+      if (written < 0) {
+        if (errno != EINTR) m_failed = true;
+        continue;
+      }
+      bytes += written;
+      length -= written;
+    }
+  }
+  m_flushed += m_used;
+  m_used = 0;
+  return !m_failed;
+}
+
+void TypedAstWriter::Append(const char *bytes, size_t length)
+{
+  while (length > 0) {
+    if (m_used == bufferSize) Flush();
+    size_t chunk = std::min(length, bufferSize - m_used);
+    memcpy(m_buffer + m_used, bytes, chunk);
+    m_used += chunk;
+    bytes += chunk;
+    length -= chunk;
+  }
+}
+
+void TypedAstWriter::Indent(int n)
+{
+  if (!m_compact && n > 0) {
+    int width = n > 80 ? 80 : n;
+    Append(pad(width), width);
+  }
+}
+
+void TypedAstWriter::AppendNumber(int number)
+{
+  char digits[16];
+  char *end = digits + sizeof(digits);
+  char *start = end;
+  unsigned int value = number < 0 ? 0u - (unsigned int) number : (unsigned int) number;
+  do {
+    *--start = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  if (number < 0) *--start = '-';
+  Append(start, end - start);
+}
+
+void TypedAstWriter::WriteLineNumber(int n, int line)
+{
+  Indent(n);
+  Append("#", 1);
+  AppendNumber(line);
+  Append("\n", 1);
+}
+
+void TypedAstWriter::WriteLine(int n, const char *text)
+{
+  Indent(n);
+  Append(text, strlen(text));
+  Append("\n", 1);
+}
+
+void TypedAstWriter::WriteSymbol(int n, Symbol symbol)
+{
+  Indent(n);
+  Append(symbol->get_string(), symbol->get_len());
+  Append("\n", 1);
+}
+
+void TypedAstWriter::WriteBoolean(int n, Boolean b)
+{
+  WriteLine(n, b ? "1" : "0");
+}
+
+void TypedAstWriter::WriteString(int n, const char *s)
+{
+  Indent(n);
+  Append("\"", 1);
+  while (*s) {
+    // copy the longest run that needs no escaping in one go
+    const char *run = s;
+    while (*s && *s != '\\' && *s != '\"' && isprint(*s)) s++;
+    Append(run, s - run);
+    if (*s == 0) break;
+
+    switch (*s) {
+    case '\\' : Append("\\\\", 2); break;
+    case '\"' : Append("\\\"", 2); break;
+    case '\n' : Append("\\n", 2); break;
+    case '\t' : Append("\\t", 2); break;
+    case '\b' : Append("\\b", 2); break;
+    case '\f' : Append("\\f", 2); break;
+    default: {
+      // octal, as print_escaped_string writes unprintable characters
+      unsigned char c = (unsigned char) *s;
+      char octal[4] = { '\\', (char) ('0' + (c >> 6)), (char) ('0' + ((c >> 3) & 7)), (char) ('0' + (c & 7)) };
+      Append(octal, 4);
+      break;
+    }
+    }
+    s++;
+  }
+  Append("\"\n", 2);
+}
+
+void TypedAstWriter::WriteType(int n, const char *type)
+{
+  Indent(n);
+  if (type) {
+    Append(": ", 2);
+    Append(type, strlen(type));
+    Append("\n", 1);
+  } else {
+    Append(": _no_type\n", 11);
+  }
+}
+
+void TypedAstWriter::WriteType(int n, Symbol type)
+{
+  Indent(n);
+  if (type) {
+    Append(": ", 2);
+    Append(type->get_string(), type->get_len());
+    Append("\n", 1);
+  } else {
+    Append(": _no_type\n", 11);
+  }
+}
+
 void dump_line(ostream& stream, int n, tree_node *t)
 {
   stream << pad(n) << "#" << t->get_line_number() << "\n";
@@ -160,7 +328,6 @@ void class__class::dump_with_types(ostream& stream, int n)
    stream << pad(n+2) << ")\n";
 }
 
-
 //
 // dump_with_types for method_class first prints that this is a method,
 // then prints the method name followed by the formal parameters
@@ -472,3 +639,771 @@ void object_class::dump_with_types(ostream& stream, int n)
    dump_type(stream,n);
 }
 
+
+//////////////////////////////////////////////////////////////////
+//
+//  The typed AST through a TypedAstWriter
+//
+//  The ostream traversal above recurses once per level of nesting,
+//  which a deep enough expression turns into a stack overflow.  The
+//  writer prints the same text from a walk over an explicit stack,
+//  like the checker and the binary encoder below, so the depth it
+//  can print is bounded by the heap.  Nodes are told apart by the
+//  kinds of the binary form, which also name them.
+//
+//////////////////////////////////////////////////////////////////
+
+static const uint8_t numBinaryAstKinds = (uint8_t) BinaryAstKind::FirstExpression + (uint8_t) ExpressionType::Object + 1;
+
+static const char* binaryAstKindNames[] = {
+  "_program", "_class", "_method", "_attr", "_formal", "_branch",
+  "_assign", "_static_dispatch", "_dispatch", "_cond", "_loop", "_typcase", "_block", "_let",
+  "_plus", "_sub", "_mul", "_divide", "_neg", "_lt", "_eq", "_leq", "_comp",
+  "_int", "_bool", "_string", "_new", "_isvoid", "_no_expr", "_object"
+};
+static_assert(sizeof(binaryAstKindNames) / sizeof(binaryAstKindNames[0]) == numBinaryAstKinds,
+  "binaryAstKindNames must have one name per BinaryAstKind");
+
+static uint8_t binary_expression_kind(ExpressionType type)
+{
+  return (uint8_t) BinaryAstKind::FirstExpression + (uint8_t) type;
+}
+
+class TypedAstTextWalk {
+public:
+  explicit TypedAstTextWalk(TypedAstWriter& writer) : m_writer(writer) {}
+
+  void Dump(tree_node *root, uint8_t kind, int n);
+
+private:
+  // A node whose children are being printed
+  struct TextFrame {
+    void AddChild(tree_node *node, uint8_t kind) { m_children.push_back(std::make_pair(node, kind)); }
+    void AddExpression(Expression expression) { AddChild(expression, binary_expression_kind(expression->get_expr_type())); }
+
+    tree_node *m_node = NULL;
+    uint8_t m_kind = 0;
+    int m_n = 0;
+    std::vector<std::pair<tree_node *, uint8_t>> m_children;  // in the order they are printed
+    size_t m_middle = 0;   // the number of children printed before the node's text in the middle
+    size_t m_next = 0;     // the next child to print
+  };
+
+  TextFrame Start(tree_node *node, uint8_t kind, int n);
+  void WriteMiddle(const TextFrame& frame);
+  void Finish(const TextFrame& frame);
+
+  TypedAstWriter& m_writer;
+};
+
+void TypedAstTextWalk::Dump(tree_node *root, uint8_t kind, int n)
+{
+  std::vector<TextFrame> stack;
+  stack.push_back(Start(root, kind, n));
+  while (!stack.empty()) {
+    TextFrame& frame = stack.back();
+    if (frame.m_next == frame.m_middle) WriteMiddle(frame);
+    if (frame.m_next < frame.m_children.size()) {
+      std::pair<tree_node *, uint8_t> child = frame.m_children[frame.m_next++];
+      stack.push_back(Start(child.first, child.second, frame.m_n + 2));
+      continue;
+    }
+
+    Finish(frame);
+    stack.pop_back();
+  }
+}
+
+// Prints the node up to its first child and lists the children
+TypedAstTextWalk::TextFrame TypedAstTextWalk::Start(tree_node *node, uint8_t kind, int n)
+{
+  TextFrame frame;
+  frame.m_node = node;
+  frame.m_kind = kind;
+  frame.m_n = n;
+  m_writer.WriteLineNumber(n, node->get_line_number());
+  m_writer.WriteLine(n, binaryAstKindNames[kind]);
+
+  switch (kind) {
+  case (uint8_t) BinaryAstKind::Program: {
+    Classes classes = static_cast<program_class*>(node)->get_classes();
+    for(int i = classes->first(); classes->more(i); i = classes->next(i))
+      frame.AddChild(classes->nth(i), (uint8_t) BinaryAstKind::Class);
+    break;
+  }
+  case (uint8_t) BinaryAstKind::Class: {
+    Class_ current = static_cast<Class_>(node);
+    m_writer.WriteSymbol(n+2, current->get_name());
+    m_writer.WriteSymbol(n+2, current->get_parent());
+    m_writer.WriteString(n+2, current->get_filename()->get_string());
+    m_writer.WriteLine(n+2, "(");
+    Features features = current->get_features();
+    for(int i = features->first(); features->more(i); i = features->next(i)) {
+      Feature feature = features->nth(i);
+      frame.AddChild(feature, (uint8_t) (feature->is_attr() ? BinaryAstKind::Attr : BinaryAstKind::Method));
+    }
+    break;
+  }
+  case (uint8_t) BinaryAstKind::Method: {
+    method_class *method = static_cast<method_class*>(node);
+    m_writer.WriteSymbol(n+2, method->get_name());
+    Formals formals = method->get_formals();
+    for(int i = formals->first(); formals->more(i); i = formals->next(i))
+      frame.AddChild(formals->nth(i), (uint8_t) BinaryAstKind::Formal);
+    frame.AddExpression(method->get_expression());
+    break;
+  }
+  case (uint8_t) BinaryAstKind::Attr: {
+    attr_class *attr = static_cast<attr_class*>(node);
+    m_writer.WriteSymbol(n+2, attr->get_name());
+    m_writer.WriteSymbol(n+2, attr->get_type());
+    frame.AddExpression(attr->get_expression());
+    break;
+  }
+  case (uint8_t) BinaryAstKind::Formal: {
+    Formal formal = static_cast<Formal>(node);
+    m_writer.WriteSymbol(n+2, formal->get_name());
+    m_writer.WriteSymbol(n+2, formal->get_type());
+    break;
+  }
+  case (uint8_t) BinaryAstKind::Branch: {
+    branch_class *branch = static_cast<branch_class*>(node);
+    m_writer.WriteSymbol(n+2, branch->get_name());
+    m_writer.WriteSymbol(n+2, branch->get_type());
+    frame.AddExpression(branch->get_expr());
+    break;
+  }
+  default: {
+    Expression expression = static_cast<Expression>(node);
+    switch (expression->get_expr_type()) {
+    case ExpressionType::Assign: {
+      assign_class* assign = static_cast<assign_class*>(expression);
+      m_writer.WriteSymbol(n+2, assign->get_symbol_name());
+      frame.AddExpression(assign->get_expr());
+      break;
+    }
+    case ExpressionType::StaticDispatch:
+    case ExpressionType::Dispatch: {
+      // the symbols are printed in the middle, after the object
+      frame.AddExpression(expression->get_dispatch_id_expr());
+      Expressions actuals = expression->get_dispatch_param_expressions();
+      for(int i = actuals->first(); actuals->more(i); i = actuals->next(i))
+        frame.AddExpression(actuals->nth(i));
+      break;
+    }
+    case ExpressionType::Conditional: {
+      cond_class* cond = static_cast<cond_class*>(expression);
+      frame.AddExpression(cond->get_pred());
+      frame.AddExpression(cond->get_then());
+      frame.AddExpression(cond->get_else());
+      break;
+    }
+    case ExpressionType::Loop: {
+      loop_class* loop = static_cast<loop_class*>(expression);
+      frame.AddExpression(loop->get_pred());
+      frame.AddExpression(loop->get_body());
+      break;
+    }
+    case ExpressionType::TypeCase: {
+      typcase_class* typcase = static_cast<typcase_class*>(expression);
+      frame.AddExpression(typcase->get_case_expr());
+      Cases cases = typcase->get_cases();
+      for(int i = cases->first(); cases->more(i); i = cases->next(i))
+        frame.AddChild(cases->nth(i), (uint8_t) BinaryAstKind::Branch);
+      break;
+    }
+    case ExpressionType::Block: {
+      Expressions body = static_cast<block_class*>(expression)->get_body();
+      for(int i = body->first(); body->more(i); i = body->next(i))
+        frame.AddExpression(body->nth(i));
+      break;
+    }
+    case ExpressionType::Let: {
+      let_class* let = static_cast<let_class*>(expression);
+      m_writer.WriteSymbol(n+2, let->get_let_id());
+      m_writer.WriteSymbol(n+2, let->get_let_type_decl());
+      frame.AddExpression(let->get_let_init());
+      frame.AddExpression(let->get_let_body());
+      break;
+    }
+    case ExpressionType::IntConst:
+      m_writer.WriteSymbol(n+2, static_cast<int_const_class*>(expression)->get_token());
+      break;
+    case ExpressionType::BoolConst:
+      m_writer.WriteBoolean(n+2, static_cast<bool_const_class*>(expression)->get_val());
+      break;
+    case ExpressionType::StringConst:
+      m_writer.WriteString(n+2, static_cast<string_const_class*>(expression)->get_token()->get_string());
+      break;
+    case ExpressionType::New:
+      m_writer.WriteSymbol(n+2, static_cast<new__class*>(expression)->get_type_name());
+      break;
+    case ExpressionType::Object:
+      m_writer.WriteSymbol(n+2, static_cast<object_class*>(expression)->get_name());
+      break;
+    case ExpressionType::NoExpr:
+      break;
+    default:
+      // the arithmetic, comparison and unary operators
+      if (expression->get_lhs() != NULL) frame.AddExpression(expression->get_lhs());
+      frame.AddExpression(expression->get_rhs());
+      break;
+    }
+    break;
+  }
+  }
+
+  if (kind == (uint8_t) BinaryAstKind::Method) {
+    frame.m_middle = frame.m_children.size() - 1;  // the formals, then the return type, then the body
+  } else if (kind == binary_expression_kind(ExpressionType::StaticDispatch) ||
+             kind == binary_expression_kind(ExpressionType::Dispatch)) {
+    frame.m_middle = 1;                            // the object, then the symbols, then the actuals
+  } else {
+    frame.m_middle = frame.m_children.size();
+  }
+  return frame;
+}
+
+void TypedAstTextWalk::WriteMiddle(const TextFrame& frame)
+{
+  int n = frame.m_n;
+  if (frame.m_kind == (uint8_t) BinaryAstKind::Method) {
+    m_writer.WriteSymbol(n+2, static_cast<method_class*>(frame.m_node)->get_type());
+  } else if (frame.m_kind == binary_expression_kind(ExpressionType::StaticDispatch)) {
+    Expression dispatch = static_cast<Expression>(frame.m_node);
+    m_writer.WriteSymbol(n+2, dispatch->get_dispatch_subclass_type());
+    m_writer.WriteSymbol(n+2, dispatch->get_dispatch_method_name());
+    m_writer.WriteLine(n+2, "(");
+  } else if (frame.m_kind == binary_expression_kind(ExpressionType::Dispatch)) {
+    m_writer.WriteSymbol(n+2, static_cast<Expression>(frame.m_node)->get_dispatch_method_name());
+    m_writer.WriteLine(n+2, "(");
+  }
+}
+
+// Prints what follows the last child
+void TypedAstTextWalk::Finish(const TextFrame& frame)
+{
+  int n = frame.m_n;
+  bool isDispatch = frame.m_kind == binary_expression_kind(ExpressionType::StaticDispatch) ||
+    frame.m_kind == binary_expression_kind(ExpressionType::Dispatch);
+  if (frame.m_kind == (uint8_t) BinaryAstKind::Class || isDispatch) m_writer.WriteLine(n+2, ")");
+  if (frame.m_kind >= (uint8_t) BinaryAstKind::FirstExpression)
+    m_writer.WriteType(n, static_cast<Expression>(frame.m_node)->get_type());
+}
+
+void program_class::dump_with_types(TypedAstWriter& writer, int n)
+{
+  TypedAstTextWalk(writer).Dump(this, (uint8_t) BinaryAstKind::Program, n);
+}
+
+void class__class::dump_with_types(TypedAstWriter& writer, int n)
+{
+  TypedAstTextWalk(writer).Dump(this, (uint8_t) BinaryAstKind::Class, n);
+}
+
+void method_class::dump_with_types(TypedAstWriter& writer, int n)
+{
+  TypedAstTextWalk(writer).Dump(this, (uint8_t) BinaryAstKind::Method, n);
+}
+
+void attr_class::dump_with_types(TypedAstWriter& writer, int n)
+{
+  TypedAstTextWalk(writer).Dump(this, (uint8_t) BinaryAstKind::Attr, n);
+}
+
+
+//////////////////////////////////////////////////////////////////
+//
+//  The binary typed AST
+//
+//  dump_binary_with_types encodes the same tree in the layout
+//  described in cool-tree.handcode.h: one fixed size record per node
+//  in pre-order, the child lists of all nodes packed one after the
+//  other, and every symbol once in a string pool.  BinaryAst maps
+//  such a file and prints it back in the dump_with_types format, so
+//  the two outputs can be compared line for line.
+//
+//////////////////////////////////////////////////////////////////
+
+static const char binaryAstMagic[8] = { 'C', 'O', 'O', 'L', 'T', 'A', 'S', 'T' };
+static const uint32_t binaryAstVersion = 2;
+
+// How many of a node's operands are symbols that must be present, by kind
+static const int binaryAstSymbolOperands[] = {
+  0, 3, 2, 2, 2, 2,
+  1, 2, 1, 0, 0, 0, 0, 2,
+  0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 0, 1, 1, 0, 0, 1
+};
+static_assert(sizeof(binaryAstSymbolOperands) / sizeof(binaryAstSymbolOperands[0]) == numBinaryAstKinds,
+  "binaryAstSymbolOperands must have one count per BinaryAstKind");
+static_assert(sizeof(BinaryAstHeader) == 32 && sizeof(BinaryAstNode) == 40,
+  "the binary typed AST records must not change size");
+
+class BinaryAstEncoder {
+public:
+  void Encode(Program program, std::string& output);
+
+private:
+  int32_t AddSymbol(Symbol symbol);
+  uint32_t AddNode(uint8_t kind, tree_node *node, int32_t a = -1, int32_t b = -1, int32_t c = -1);
+  void SetChildren(uint32_t index, const std::vector<uint32_t>& children);
+  void SetBinding(uint32_t index, Binding binding);
+
+  // A node whose children are being encoded
+  struct EncodeFrame {
+    void AddPending(tree_node *node, bool isBranch = false) { m_pending.push_back(node); m_pendingBranches.push_back(isBranch); }
+
+    uint32_t m_index = 0;
+    Expression m_expression = NULL;   // NULL for a branch, which has no type
+    std::vector<tree_node *> m_pending; // children in order, each an expression or a branch
+    std::vector<bool> m_pendingBranches;
+    size_t m_next = 0;                // the next pending child to encode
+    std::vector<uint32_t> m_children;  // node indices of the children encoded so far
+  };
+
+  uint32_t EncodeClass(Class_ current);
+  uint32_t EncodeFeature(Feature feature);
+  uint32_t EncodeExpression(Expression expression);
+  EncodeFrame StartExpression(Expression expression);
+  EncodeFrame StartBranch(branch_class *branch);
+
+  std::vector<BinaryAstNode> m_nodes;
+  std::vector<uint32_t> m_children;
+  std::vector<uint32_t> m_symbolOffsets;
+  std::string m_strings;
+  std::unordered_map<Symbol, int32_t> m_symbolIndices;
+};
+
+int32_t BinaryAstEncoder::AddSymbol(Symbol symbol)
+{
+  if (symbol == NULL) return -1;
+  auto found = m_symbolIndices.find(symbol);
+  if (found != m_symbolIndices.end()) return found->second;
+
+  int32_t index = m_symbolOffsets.size();
+  m_symbolOffsets.push_back(m_strings.size());
+  m_strings.append(symbol->get_string());
+  m_strings.push_back('\0');
+  m_symbolIndices.emplace(symbol, index);
+  return index;
+}
+
+uint32_t BinaryAstEncoder::AddNode(uint8_t kind, tree_node *node, int32_t a, int32_t b, int32_t c)
+{
+  BinaryAstNode record;
+  memset(&record, 0, sizeof(record));
+  record.kind = kind;
+  record.line = node->get_line_number();
+  record.type = -1;
+  record.operands[0] = a;
+  record.operands[1] = b;
+  record.operands[2] = c;
+  record.bindingKind = (uint8_t) BindingKind::Unresolved;
+  record.bindingIndex = -1;
+  m_nodes.push_back(record);
+  return m_nodes.size() - 1;
+}
+
+// Children are encoded before their parent's child list is written, which keeps every list contiguous
+void BinaryAstEncoder::SetChildren(uint32_t index, const std::vector<uint32_t>& children)
+{
+  m_nodes[index].firstChild = m_children.size();
+  m_nodes[index].numChildren = children.size();
+  m_children.insert(m_children.end(), children.begin(), children.end());
+}
+
+void BinaryAstEncoder::SetBinding(uint32_t index, Binding binding)
+{
+  m_nodes[index].bindingKind = (uint8_t) binding.kind;
+  m_nodes[index].bindingIndex = binding.index;
+}
+
+void BinaryAstEncoder::Encode(Program program, std::string& output)
+{
+  uint32_t root = AddNode((uint8_t) BinaryAstKind::Program, program);
+  std::vector<uint32_t> children;
+  Classes classes = program->get_classes();
+  for(int i = classes->first(); classes->more(i); i = classes->next(i))
+    children.push_back(EncodeClass(classes->nth(i)));
+  SetChildren(root, children);
+
+  BinaryAstHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, binaryAstMagic, sizeof(header.magic));
+  header.version = binaryAstVersion;
+  header.numNodes = m_nodes.size();
+  header.numChildren = m_children.size();
+  header.numSymbols = m_symbolOffsets.size();
+  header.stringBytes = m_strings.size();
+
+  output.clear();
+  output.reserve(sizeof(header) + m_nodes.size() * sizeof(BinaryAstNode) +
+    (m_children.size() + m_symbolOffsets.size()) * sizeof(uint32_t) + m_strings.size());
+  output.append((const char *) &header, sizeof(header));
+  output.append((const char *) m_nodes.data(), m_nodes.size() * sizeof(BinaryAstNode));
+  output.append((const char *) m_children.data(), m_children.size() * sizeof(uint32_t));
+  output.append((const char *) m_symbolOffsets.data(), m_symbolOffsets.size() * sizeof(uint32_t));
+  output.append(m_strings);
+}
+
+uint32_t BinaryAstEncoder::EncodeClass(Class_ current)
+{
+  uint32_t index = AddNode((uint8_t) BinaryAstKind::Class, current,
+    AddSymbol(current->get_name()), AddSymbol(current->get_parent()), AddSymbol(current->get_filename()));
+  std::vector<uint32_t> children;
+  Features features = current->get_features();
+  for(int i = features->first(); features->more(i); i = features->next(i))
+    children.push_back(EncodeFeature(features->nth(i)));
+  SetChildren(index, children);
+  return index;
+}
+
+uint32_t BinaryAstEncoder::EncodeFeature(Feature feature)
+{
+  std::vector<uint32_t> children;
+  uint32_t index;
+  if (feature->is_attr()) {
+    index = AddNode((uint8_t) BinaryAstKind::Attr, feature, AddSymbol(feature->get_name()), AddSymbol(feature->get_type()));
+  } else {
+    index = AddNode((uint8_t) BinaryAstKind::Method, feature, AddSymbol(feature->get_name()), AddSymbol(feature->get_type()));
+    Formals formals = static_cast<method_class*>(feature)->get_formals();
+    for(int i = formals->first(); formals->more(i); i = formals->next(i)) {
+      Formal formal = formals->nth(i);
+      children.push_back(AddNode((uint8_t) BinaryAstKind::Formal, formal, AddSymbol(formal->get_name()), AddSymbol(formal->get_type())));
+    }
+  }
+  m_nodes[index].localSlots = feature->get_local_slots();
+  children.push_back(EncodeExpression(feature->get_expression()));
+  SetChildren(index, children);
+  return index;
+}
+
+// Expressions are encoded over an explicit stack like the checker walks them, so that nesting depth is bounded by
+// the heap and not by the C++ stack. Nodes are still numbered in pre-order and every child list is written once
+// the children's own lists are, so the output is what a recursive encoder would write.
+uint32_t BinaryAstEncoder::EncodeExpression(Expression expression)
+{
+  std::vector<EncodeFrame> stack;
+  stack.push_back(StartExpression(expression));
+
+  uint32_t index = 0;
+  while (!stack.empty()) {
+    EncodeFrame& frame = stack.back();
+    if (frame.m_next < frame.m_pending.size()) {
+      tree_node *child = frame.m_pending[frame.m_next];
+      bool isBranch = frame.m_pendingBranches[frame.m_next];
+      frame.m_next++;
+      stack.push_back(isBranch ? StartBranch(static_cast<branch_class*>(child)) : StartExpression(static_cast<Expression>(child)));
+      continue;
+    }
+
+    index = frame.m_index;
+    if (frame.m_expression != NULL) m_nodes[index].type = AddSymbol(frame.m_expression->get_type());
+    SetChildren(index, frame.m_children);
+    stack.pop_back();
+    if (!stack.empty()) stack.back().m_children.push_back(index);
+  }
+  return index;
+}
+
+BinaryAstEncoder::EncodeFrame BinaryAstEncoder::StartBranch(branch_class *branch)
+{
+  EncodeFrame frame;
+  frame.m_index = AddNode((uint8_t) BinaryAstKind::Branch, branch, AddSymbol(branch->get_name()), AddSymbol(branch->get_type()));
+  frame.AddPending(branch->get_expr());
+  return frame;
+}
+
+// Adds the expression's node with its symbols and lists the subexpressions still to encode
+BinaryAstEncoder::EncodeFrame BinaryAstEncoder::StartExpression(Expression expression)
+{
+  ExpressionType type = expression->get_expr_type();
+  uint8_t kind = binary_expression_kind(type);
+  EncodeFrame frame;
+  frame.m_expression = expression;
+
+  switch (type) {
+  case ExpressionType::Assign: {
+    assign_class* assign = static_cast<assign_class*>(expression);
+    frame.m_index = AddNode(kind, expression, AddSymbol(assign->get_symbol_name()));
+    SetBinding(frame.m_index, assign->get_binding());
+    frame.AddPending(assign->get_expr());
+    break;
+  }
+  case ExpressionType::StaticDispatch:
+  case ExpressionType::Dispatch: {
+    frame.m_index = type == ExpressionType::StaticDispatch
+      ? AddNode(kind, expression, AddSymbol(expression->get_dispatch_subclass_type()), AddSymbol(expression->get_dispatch_method_name()))
+      : AddNode(kind, expression, AddSymbol(expression->get_dispatch_method_name()));
+    frame.AddPending(expression->get_dispatch_id_expr());
+    Expressions actuals = expression->get_dispatch_param_expressions();
+    for(int i = actuals->first(); actuals->more(i); i = actuals->next(i))
+      frame.AddPending(actuals->nth(i));
+    break;
+  }
+  case ExpressionType::Conditional: {
+    cond_class* cond = static_cast<cond_class*>(expression);
+    frame.m_index = AddNode(kind, expression);
+    frame.AddPending(cond->get_pred());
+    frame.AddPending(cond->get_then());
+    frame.AddPending(cond->get_else());
+    break;
+  }
+  case ExpressionType::Loop: {
+    loop_class* loop = static_cast<loop_class*>(expression);
+    frame.m_index = AddNode(kind, expression);
+    frame.AddPending(loop->get_pred());
+    frame.AddPending(loop->get_body());
+    break;
+  }
+  case ExpressionType::TypeCase: {
+    typcase_class* typcase = static_cast<typcase_class*>(expression);
+    frame.m_index = AddNode(kind, expression);
+    frame.AddPending(typcase->get_case_expr());
+    Cases cases = typcase->get_cases();
+    for(int i = cases->first(); cases->more(i); i = cases->next(i))
+      frame.AddPending(cases->nth(i), true);
+    break;
+  }
+  case ExpressionType::Block: {
+    Expressions body = static_cast<block_class*>(expression)->get_body();
+    frame.m_index = AddNode(kind, expression);
+    for(int i = body->first(); body->more(i); i = body->next(i))
+      frame.AddPending(body->nth(i));
+    break;
+  }
+  case ExpressionType::Let: {
+    let_class* let = static_cast<let_class*>(expression);
+    frame.m_index = AddNode(kind, expression, AddSymbol(let->get_let_id()), AddSymbol(let->get_let_type_decl()));
+    frame.AddPending(let->get_let_init());
+    frame.AddPending(let->get_let_body());
+    break;
+  }
+  case ExpressionType::IntConst:
+    frame.m_index = AddNode(kind, expression, AddSymbol(static_cast<int_const_class*>(expression)->get_token()));
+    break;
+  case ExpressionType::BoolConst:
+    frame.m_index = AddNode(kind, expression, static_cast<bool_const_class*>(expression)->get_val() ? 1 : 0);
+    break;
+  case ExpressionType::StringConst:
+    frame.m_index = AddNode(kind, expression, AddSymbol(static_cast<string_const_class*>(expression)->get_token()));
+    break;
+  case ExpressionType::New:
+    frame.m_index = AddNode(kind, expression, AddSymbol(static_cast<new__class*>(expression)->get_type_name()));
+    break;
+  case ExpressionType::Object:
+    frame.m_index = AddNode(kind, expression, AddSymbol(static_cast<object_class*>(expression)->get_name()));
+    SetBinding(frame.m_index, static_cast<object_class*>(expression)->get_binding());
+    break;
+  case ExpressionType::NoExpr:
+    frame.m_index = AddNode(kind, expression);
+    break;
+  default:
+    // the arithmetic, comparison and unary operators
+    frame.m_index = AddNode(kind, expression);
+    if (expression->get_lhs() != NULL) frame.AddPending(expression->get_lhs());
+    frame.AddPending(expression->get_rhs());
+    break;
+  }
+  return frame;
+}
+
+void dump_binary_with_types(Program program, std::string& output)
+{
+  BinaryAstEncoder encoder;
+  encoder.Encode(program, output);
+}
+
+BinaryAst::~BinaryAst()
+{
+  if (m_mapping != NULL) munmap(m_mapping, m_mappingLength);
+}
+
+bool BinaryAst::Load(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat status;
+  void *mapping = MAP_FAILED;
+  if (fstat(fd, &status) == 0 && status.st_size > 0)
+    mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return false;
+
+  if (m_mapping != NULL) munmap(m_mapping, m_mappingLength);
+  m_mapping = mapping;
+  m_mappingLength = status.st_size;
+  return Load((const char *) mapping, m_mappingLength);
+}
+
+// Checks every size, index and kind up front so that the accessors and DumpWithTypes need no checks of their own
+bool BinaryAst::Load(const char *bytes, size_t length)
+{
+  m_header = NULL;
+  if (length < sizeof(BinaryAstHeader)) return false;
+  const BinaryAstHeader *header = (const BinaryAstHeader *) bytes;
+  if (memcmp(header->magic, binaryAstMagic, sizeof(binaryAstMagic)) != 0 || header->version != binaryAstVersion) return false;
+  if (header->numNodes == 0) return false;
+
+  uint64_t expectedLength = sizeof(BinaryAstHeader) + (uint64_t) header->numNodes * sizeof(BinaryAstNode) +
+    ((uint64_t) header->numChildren + header->numSymbols) * sizeof(uint32_t) + header->stringBytes;
+  if (expectedLength != length) return false;
+
+  const BinaryAstNode *nodes = (const BinaryAstNode *) (bytes + sizeof(BinaryAstHeader));
+  const uint32_t *children = (const uint32_t *) (nodes + header->numNodes);
+  const uint32_t *symbolOffsets = children + header->numChildren;
+  const char *strings = (const char *) (symbolOffsets + header->numSymbols);
+
+  if (header->stringBytes > 0 && strings[header->stringBytes - 1] != '\0') return false;
+  for (uint32_t i = 0; i < header->numSymbols; i++)
+    if (symbolOffsets[i] >= header->stringBytes) return false;
+
+  int32_t numSymbols = header->numSymbols;
+  for (uint32_t i = 0; i < header->numNodes; i++) {
+    const BinaryAstNode& node = nodes[i];
+    if (node.kind >= numBinaryAstKinds) return false;
+    if (node.type < -1 || node.type >= numSymbols) return false;
+    if (node.bindingKind > (uint8_t) BindingKind::Local || node.bindingIndex < -1 || node.localSlots < 0) return false;
+    for (int j = 0; j < binaryAstSymbolOperands[node.kind]; j++)
+      if (node.operands[j] < 0 || node.operands[j] >= numSymbols) return false;
+    bool isDispatch = node.kind == binary_expression_kind(ExpressionType::StaticDispatch) ||
+      node.kind == binary_expression_kind(ExpressionType::Dispatch);
+    if (isDispatch && node.numChildren == 0) return false;
+    if ((uint64_t) node.firstChild + node.numChildren > header->numChildren) return false;
+    // children always follow their parent in pre-order, so the tree has no cycles
+    for (uint32_t j = 0; j < node.numChildren; j++)
+      if (children[node.firstChild + j] <= i || children[node.firstChild + j] >= header->numNodes) return false;
+  }
+
+  m_header = header;
+  m_nodes = nodes;
+  m_children = children;
+  m_symbolOffsets = symbolOffsets;
+  m_strings = strings;
+  return true;
+}
+
+// Like the encoder the tree is walked over an explicit stack, a frame is resumed every time one of its children
+// has been printed
+void BinaryAst::DumpWithTypes(TypedAstWriter& writer) const
+{
+  std::vector<DumpFrame> stack;
+  stack.push_back(DumpFrame { 0, 0, 0, false });
+  while (!stack.empty()) {
+    int64_t child = ResumeDump(writer, stack.back());
+    if (child >= 0) {
+      stack.push_back(DumpFrame { (uint32_t) child, stack.back().n + 2, 0, false });
+    } else {
+      stack.pop_back();
+    }
+  }
+}
+
+// The number of children printed before a node's text in the middle, the text between them and the rest
+static uint32_t binary_middle_position(const BinaryAstNode& node)
+{
+  if (node.kind == (uint8_t) BinaryAstKind::Method) {
+    // the formals, then the return type, then the body
+    return node.numChildren > 0 ? node.numChildren - 1 : 0;
+  }
+  if (node.kind == binary_expression_kind(ExpressionType::StaticDispatch) ||
+      node.kind == binary_expression_kind(ExpressionType::Dispatch)) {
+    // the object comes before the symbols and the actuals are listed in parentheses
+    return 1;
+  }
+  return node.numChildren;
+}
+
+// Prints the node up to its next child and returns that child, or -1 once the whole node has been printed
+int64_t BinaryAst::ResumeDump(TypedAstWriter& writer, DumpFrame& frame) const
+{
+  const BinaryAstNode& node = m_nodes[frame.index];
+  int n = frame.n;
+  bool isExpression = node.kind >= (uint8_t) BinaryAstKind::FirstExpression;
+  bool isDispatch = node.kind == binary_expression_kind(ExpressionType::StaticDispatch) ||
+    node.kind == binary_expression_kind(ExpressionType::Dispatch);
+
+  if (frame.child == 0 && !frame.middleWritten) { // the first time the frame is resumed
+    writer.WriteLineNumber(n, node.line);
+    writer.WriteLine(n, binaryAstKindNames[node.kind]);
+    switch (node.kind) {
+    case (uint8_t) BinaryAstKind::Program:
+      break;
+    case (uint8_t) BinaryAstKind::Class:
+      writer.WriteLine(n+2, GetSymbol(node.operands[0]));
+      writer.WriteLine(n+2, GetSymbol(node.operands[1]));
+      writer.WriteString(n+2, GetSymbol(node.operands[2]));
+      writer.WriteLine(n+2, "(");
+      break;
+    case (uint8_t) BinaryAstKind::Method:
+      writer.WriteLine(n+2, GetSymbol(node.operands[0]));
+      break;
+    case (uint8_t) BinaryAstKind::Attr:
+    case (uint8_t) BinaryAstKind::Formal:
+    case (uint8_t) BinaryAstKind::Branch:
+      writer.WriteLine(n+2, GetSymbol(node.operands[0]));
+      writer.WriteLine(n+2, GetSymbol(node.operands[1]));
+      break;
+    default:
+      if (node.kind == binary_expression_kind(ExpressionType::BoolConst)) {
+        writer.WriteBoolean(n+2, node.operands[0] != 0);
+      } else if (node.kind == binary_expression_kind(ExpressionType::StringConst)) {
+        writer.WriteString(n+2, GetSymbol(node.operands[0]));
+      } else if (!isDispatch) {
+        // symbols first, then the subexpressions
+        for (int i = 0; i < binaryAstSymbolOperands[node.kind]; i++) writer.WriteLine(n+2, GetSymbol(node.operands[i]));
+      }
+      break;
+    }
+  }
+
+  uint32_t middle = binary_middle_position(node);
+  if (frame.child < middle) return GetChild(node, frame.child++);
+
+  if (!frame.middleWritten) {
+    frame.middleWritten = true;
+    if (node.kind == (uint8_t) BinaryAstKind::Method) {
+      writer.WriteLine(n+2, GetSymbol(node.operands[1]));
+    } else if (isDispatch) {
+      for (int i = 0; i < binaryAstSymbolOperands[node.kind]; i++) writer.WriteLine(n+2, GetSymbol(node.operands[i]));
+      writer.WriteLine(n+2, "(");
+    }
+  }
+  if (frame.child < node.numChildren) return GetChild(node, frame.child++);
+
+  if (node.kind == (uint8_t) BinaryAstKind::Class || isDispatch) writer.WriteLine(n+2, ")");
+  if (isExpression) writer.WriteType(n, GetSymbol(node.type));
+  return -1;
+}
+
+static const char *bindingKindNames[] = { "unresolved", "self", "attribute", "formal", "local" };
+static_assert(sizeof(bindingKindNames) / sizeof(bindingKindNames[0]) == (size_t) BindingKind::Local + 1,
+  "bindingKindNames must have one name per BindingKind");
+
+void write_feature_slots(ostream& stream, int line, const char *className, const char *featureName, int localSlots)
+{
+  stream << "#" << line << " " << className << "." << featureName << " slots " << localSlots << "\n";
+}
+
+void write_binding(ostream& stream, int line, const char *name, Binding binding)
+{
+  stream << "#" << line << "   " << name << " " << bindingKindNames[(int) binding.kind] << " " << binding.index << "\n";
+}
+
+// The nodes are in pre-order, so a feature's class is the last class seen and its uses follow it
+void BinaryAst::WriteBindings(ostream& stream) const
+{
+  const char *className = NULL;
+  for (uint32_t i = 0; i < m_header->numNodes; i++) {
+    const BinaryAstNode& node = m_nodes[i];
+    if (node.kind == (uint8_t) BinaryAstKind::Class) {
+      className = GetSymbol(node.operands[0]);
+    } else if (node.kind == (uint8_t) BinaryAstKind::Method || node.kind == (uint8_t) BinaryAstKind::Attr) {
+      write_feature_slots(stream, node.line, className, GetSymbol(node.operands[0]), node.localSlots);
+    } else if (node.kind == binary_expression_kind(ExpressionType::Object) ||
+               node.kind == binary_expression_kind(ExpressionType::Assign)) {
+      write_binding(stream, node.line, GetSymbol(node.operands[0]), Binding { (BindingKind) node.bindingKind, node.bindingIndex });
+    }
+  }
+}
@@ -0,0 +1,293 @@
+(* Many type errors spread over several classes and features, for max-errors-test *)
+
+class E0 {
+  a0 : Int <- "not an int";
+  m0(x : Int) : Int {
+    {
+      x <- true;
+      y0 + 1;
+      not x;
+      "s";
+    }
+  };
+  m1(x : Int) : Int {
+    {
+      x <- true;
+      y1 + 1;
+      not x;
+      "s";
+    }
+  };
+  m2(x : Int) : Int {
+    {
+      x <- true;
+      y2 + 1;
+      not x;
+      "s";
+    }
+  };
+  m3(x : Int) : Int {
+    {
+      x <- true;
+      y3 + 1;
+      not x;
+      "s";
+    }
+  };
+};
+
+class E1 {
+  a1 : Int <- "not an int";
+  m0(x : Int) : Int {
+    {
+      x <- true;
+      y0 + 1;
+      not x;
+      "s";
+    }
+  };
+  m1(x : Int) : Int {
+    {
+      x <- true;
+      y1 + 1;
+      not x;
+      "s";
+    }
+  };
+  m2(x : Int) : Int {
+    {
+      x <- true;
+      y2 + 1;
+      not x;
+      "s";
+    }
+  };
+  m3(x : Int) : Int {
+    {
+      x <- true;
+      y3 + 1;
+      not x;
+      "s";
+    }
+  };
+};
+
+class E2 {
+  a2 : Int <- "not an int";
+  m0(x : Int) : Int {
+    {
+      x <- true;
+      y0 + 1;
+      not x;
+      "s";
+    }
+  };
+  m1(x : Int) : Int {
+    {
+      x <- true;
+      y1 + 1;
+      not x;
+      "s";
+    }
+  };
+  m2(x : Int) : Int {
+    {
+      x <- true;
+      y2 + 1;
+      not x;
+      "s";
+    }
+  };
+  m3(x : Int) : Int {
+    {
+      x <- true;
+      y3 + 1;
+      not x;
+      "s";
+    }
+  };
+};
+
+class E3 {
+  a3 : Int <- "not an int";
+  m0(x : Int) : Int {
+    {
+      x <- true;
+      y0 + 1;
+      not x;
+      "s";
+    }
+  };
+  m1(x : Int) : Int {
+    {
+      x <- true;
+      y1 + 1;
+      not x;
+      "s";
+    }
+  };
+  m2(x : Int) : Int {
+    {
+      x <- true;
+      y2 + 1;
+      not x;
+      "s";
+    }
+  };
+  m3(x : Int) : Int {
+    {
+      x <- true;
+      y3 + 1;
+      not x;
+      "s";
+    }
+  };
+};
+
+class E4 {
+  a4 : Int <- "not an int";
+  m0(x : Int) : Int {
+    {
+      x <- true;
+      y0 + 1;
+      not x;
+      "s";
+    }
+  };
+  m1(x : Int) : Int {
+    {
+      x <- true;
+      y1 + 1;
+      not x;
+      "s";
+    }
+  };
+  m2(x : Int) : Int {
+    {
+      x <- true;
+      y2 + 1;
+      not x;
+      "s";
+    }
+  };
+  m3(x : Int) : Int {
+    {
+      x <- true;
+      y3 + 1;
+      not x;
+      "s";
+    }
+  };
+};
+
+class E5 {
+  a5 : Int <- "not an int";
+  m0(x : Int) : Int {
+    {
+      x <- true;
+      y0 + 1;
+      not x;
+      "s";
+    }
+  };
+  m1(x : Int) : Int {
+    {
+      x <- true;
+      y1 + 1;
+      not x;
+      "s";
+    }
+  };
+  m2(x : Int) : Int {
+    {
+      x <- true;
+      y2 + 1;
+      not x;
+      "s";
+    }
+  };
+  m3(x : Int) : Int {
+    {
+      x <- true;
+      y3 + 1;
+      not x;
+      "s";
+    }
+  };
+};
+
+class E6 {
+  a6 : Int <- "not an int";
+  m0(x : Int) : Int {
+    {
+      x <- true;
+      y0 + 1;
+      not x;
+      "s";
+    }
+  };
+  m1(x : Int) : Int {
+    {
+      x <- true;
+      y1 + 1;
+      not x;
+      "s";
+    }
+  };
+  m2(x : Int) : Int {
+    {
+      x <- true;
+      y2 + 1;
+      not x;
+      "s";
+    }
+  };
+  m3(x : Int) : Int {
+    {
+      x <- true;
+      y3 + 1;
+      not x;
+      "s";
+    }
+  };
+};
+
+class E7 {
+  a7 : Int <- "not an int";
+  m0(x : Int) : Int {
+    {
+      x <- true;
+      y0 + 1;
+      not x;
+      "s";
+    }
+  };
+  m1(x : Int) : Int {
+    {
+      x <- true;
+      y1 + 1;
+      not x;
+      "s";
+    }
+  };
+  m2(x : Int) : Int {
+    {
+      x <- true;
+      y2 + 1;
+      not x;
+      "s";
+    }
+  };
+  m3(x : Int) : Int {
+    {
+      x <- true;
+      y3 + 1;
+      not x;
+      "s";
+    }
+  };
+};
+
+class Main {
+  main() : Object { (new E0).m0(false) };
+};
@@ -6,9 +6,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include "cool-io.h"
 #include <unistd.h>
 #include "cgen_gc.h"
+#include <vector>
 
 //
 // coolc provides a debugging switch for each phase of the compiler,
@@ -26,6 +28,31 @@ extern int yy_flex_debug;       // for the lexer; prints recognized rules
 extern int cool_yydebug;        // for the parser
        int lex_verbose;         // also for the lexer; prints tokens
        int semant_debug;        // for semantic analysis
+       int semant_jobs;         // worker threads for type checking, 0 = one per core
+       char *semant_incremental_file; // state kept between runs to re-check only edited features
+       char *semant_cache_dir;  // directory of cached results keyed by the input AST
+       std::vector<const char*> semant_interface_files; // class interfaces of separately checked classes
+       char *semant_export_file; // write the interface of the checked classes here
+       char *semant_dependency_file; // write the class dependency graph of the checked features here
+       char *semant_affected_class; // list the checked features that depend on this class
+       int semant_server;       // answer check requests on stdin until it is closed
+       int semant_batch;        // check every AST file named on the command line
+       int semant_watch;        // check the named COOL files again whenever one of them changes
+       int semant_query;        // answer type and definition queries about the named AST file
+       int semant_max_errors;   // stop checking after this many errors, 0 = no limit
+       int semant_diagnostics_json; // write diagnostics as one JSON object instead of text
+       int semant_compact_output; // write the typed AST without indentation
+       int semant_binary_output; // write the typed AST in the binary form instead of text
+       char *semant_decode_file; // print this binary typed AST as text instead of checking
+       int semant_stream_output; // write each class of the typed AST as soon as it has been checked
+       int semant_list_bindings; // print what each variable use resolved to instead of the typed AST
+       int semant_phase_timing; // print the time spent in each phase when the run finishes
+       int semant_cost_ranking; // print this many of the most expensive classes and features to check
+       char *semant_cost_file;  // write what checking each class and feature cost here as CSV
+       int semant_counters;     // count hot operations, see HotCounter
+       char *semant_counters_file; // write the counts here when the run finishes, "-" for stderr
+       int semant_allocation_profile; // charge every allocation to a subsystem and print them when the run finishes
+       int semant_hardware_counters; // count cycles, instructions and misses per phase, printed with the phase times
        int cgen_debug;          // for code gen
        bool disable_reg_alloc;  // Don't do register allocation
 
@@ -48,12 +75,36 @@ void handle_flags(int argc, char *argv[]) {
   cool_yydebug = 0;
   lex_verbose  = 0;
   semant_debug = 0;
+  semant_jobs = 1;
+  semant_incremental_file = NULL;
+  semant_cache_dir = NULL;
+  semant_export_file = NULL;
+  semant_dependency_file = NULL;
+  semant_affected_class = NULL;
+  semant_server = 0;
+  semant_batch = 0;
+  semant_watch = 0;
+  semant_query = 0;
+  semant_max_errors = 0;
+  semant_diagnostics_json = 0;
+  semant_compact_output = 0;
+  semant_binary_output = 0;
+  semant_decode_file = NULL;
+  semant_stream_output = 0;
+  semant_list_bindings = 0;
+  semant_phase_timing = 0;
+  semant_cost_ranking = 0;
+  semant_cost_file = NULL;
+  semant_counters = 0;
+  semant_counters_file = NULL;
+  semant_allocation_profile = 0;
+  semant_hardware_counters = 0;
   cgen_debug = 0;
   cgen_optimize = 0;
   disable_reg_alloc = 0;
   
 
-  while ((c = getopt(argc, argv, "lpscvrOo:gtT")) != -1) {
+  while ((c = getopt(argc, argv, "lpscvrOo:gtTj:i:C:I:E:G:a:SBWQM:JNbD:PLRK:F:U:AH")) != -1) {
     switch (c) {
 #ifdef DEBUG
     case 'l':
@@ -99,6 +150,107 @@ void handle_flags(int argc, char *argv[]) {
     case 'O':  // enable optimization
       cgen_optimize = 1;
       break;
+    case 'j':  // number of threads used to type check features, or files in batch mode
+      {
+        char *end;
+        long jobs = strtol(optarg, &end, 10);
+        if (end == optarg || *end != '\0' || jobs < 0 || jobs > INT_MAX) {
+          cerr << argv[0] << ": -j takes a number of threads, 0 for one per core, not '" << optarg << "'\n";
+          unknownopt = 1;
+        } else {
+          semant_jobs = jobs;
+        }
+      }
+      break;
+    case 'i':  // incremental type checking state file
+      semant_incremental_file = optarg;
+      break;
+    case 'C':  // semant result cache directory
+      semant_cache_dir = optarg;
+      break;
+    case 'I':  // import a class interface file, may be repeated
+      semant_interface_files.push_back(optarg);
+      break;
+    case 'E':  // export the interface of the checked classes
+      semant_export_file = optarg;
+      break;
+    case 'G':  // export the class dependency graph
+      semant_dependency_file = optarg;
+      break;
+    case 'a':  // features affected by a change to a class
+      semant_affected_class = optarg;
+      break;
+    case 'S':  // server mode
+      semant_server = 1;
+      break;
+    case 'B':  // batch mode
+      semant_batch = 1;
+      break;
+    case 'W':  // watch mode
+      semant_watch = 1;
+      break;
+    case 'Q':  // query mode
+      semant_query = 1;
+      break;
+    case 'M':  // maximum number of errors
+      {
+        char *end;
+        long maxErrors = strtol(optarg, &end, 10);
+        if (end == optarg || *end != '\0' || maxErrors < 0 || maxErrors > INT_MAX) {
+          cerr << argv[0] << ": -M takes a number of errors, 0 for no limit, not '" << optarg << "'\n";
+          unknownopt = 1;
+        } else {
+          semant_max_errors = maxErrors;
+        }
+      }
+      break;
+    case 'J':  // JSON diagnostics
+      semant_diagnostics_json = 1;
+      break;
+    case 'N':  // compact typed AST
+      semant_compact_output = 1;
+      break;
+    case 'b':  // binary typed AST
+      semant_binary_output = 1;
+      break;
+    case 'D':  // decode a binary typed AST
+      semant_decode_file = optarg;
+      break;
+    case 'P':  // stream the typed AST class by class
+      semant_stream_output = 1;
+      break;
+    case 'L':  // list the resolved bindings
+      semant_list_bindings = 1;
+      break;
+    case 'R':  // phase timing report
+      semant_phase_timing = 1;
+      break;
+    case 'K':  // most expensive classes and features
+      {
+        char *end;
+        long entries = strtol(optarg, &end, 10);
+        if (end == optarg || *end != '\0' || entries <= 0 || entries > INT_MAX) {
+          cerr << argv[0] << ": -K takes a number of entries to list, not '" << optarg << "'\n";
+          unknownopt = 1;
+        } else {
+          semant_cost_ranking = entries;
+        }
+      }
+      break;
+    case 'F':  // cost of every class and feature as CSV
+      semant_cost_file = optarg;
+      break;
+    case 'U':  // operation counts
+      semant_counters = 1;
+      semant_counters_file = optarg;
+      break;
+    case 'A':  // allocation profile
+      semant_allocation_profile = 1;
+      break;
+    case 'H':  // hardware counters, part of the phase report
+      semant_hardware_counters = 1;
+      semant_phase_timing = 1;
+      break;
     case '?':
       unknownopt = 1;
       break;
@@ -108,12 +260,24 @@ void handle_flags(int argc, char *argv[]) {
     }
   }
 
+  // the binary typed AST can't be streamed, its header needs the node count of the whole program
+  if (semant_binary_output && semant_stream_output) {
+    cerr << argv[0] << ": -b can't be combined with -P\n";
+    unknownopt = 1;
+  }
+
+  // -L replaces the typed AST, there is no binary or streamed form of the listing
+  if (semant_list_bindings && (semant_binary_output || semant_stream_output)) {
+    cerr << argv[0] << ": -L can't be combined with -b or -P\n";
+    unknownopt = 1;
+  }
+
   if (unknownopt) {
       cerr << "usage: " << argv[0] << 
 #ifdef DEBUG
-	  " [-lvpscOgtTr -o outname] [input-files]\n";
+	  " [-lvpscOgtTrSBWQJNbPLRAH -o outname -j jobs -i statefile -C cachedir -I interface -E interface -G graph -a class -M maxerrors -D binaryast -K entries -F costfile -U countfile] [input-files]\n";
 #else
-      " [-OgtT -o outname] [input-files]\n";
+      " [-OgtTSBWQJNbPLRAH -o outname -j jobs -i statefile -C cachedir -I interface -E interface -G graph -a class -M maxerrors -D binaryast -K entries -F costfile -U countfile] [input-files]\n";
 #endif
       exit(1);
   }
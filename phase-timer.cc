@@ -0,0 +1,374 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "semant.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+static const char* phaseNames[] =
+{
+    "parse",
+    "install basic classes",
+    "install interfaces",
+    "validate inheritance",
+    "class gather",
+    "method gather",
+    "override check",
+    "attribute gather",
+    "feature check",
+    "write typed AST (bytes)"
+};
+static_assert(sizeof(phaseNames) / sizeof(phaseNames[0]) == static_cast<size_t>(SemantPhase::NumPhases),
+    "phaseNames must have one name per SemantPhase");
+
+struct PhaseTotals
+{
+    std::atomic<int64_t> m_nanoseconds{0};
+    std::atomic<int64_t> m_items{0};
+    std::atomic<int> m_runs{0};
+    std::atomic<int64_t> m_rssAddedKilobytes{0};
+    std::atomic<int64_t> m_heapAddedBytes{0};
+    std::atomic<int64_t> m_maxRssKilobytes{-1}; // the most at the end of a run of the phase
+    std::atomic<int64_t> m_maxHeapBytes{-1};
+    std::atomic<int64_t> m_hardwareCounts[static_cast<int>(HardwareCounter::NumCounters)] = {};
+};
+
+static PhaseTotals phaseTotals[static_cast<int>(SemantPhase::NumPhases)];
+
+// Static initialization happens as the process starts, so the whole run is measured from here
+static const std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
+
+static void AtomicMax(std::atomic<int64_t>& maximum, int64_t value)
+{
+    int64_t current = maximum.load();
+    while (value > current && !maximum.compare_exchange_weak(current, value)) {}
+}
+
+// The value of a "Name:   1234 kB" line of /proc/self/status
+static int64_t StatusField(const char* status, const char* name)
+{
+    const char* field = strstr(status, name);
+    return field == nullptr ? -1 : strtoll(field + strlen(name), nullptr, 10);
+}
+
+MemorySample sample_memory()
+{
+    MemorySample sample;
+
+    // read with a fixed buffer, an ifstream would allocate and show up in the heap it is measuring
+    int fd = open("/proc/self/status", O_RDONLY);
+    if (fd >= 0)
+    {
+        char status[4096];
+        ssize_t length = read(fd, status, sizeof(status) - 1);
+        close(fd);
+        if (length > 0)
+        {
+            status[length] = '\0';
+            sample.m_rssKilobytes = StatusField(status, "VmRSS:");
+            sample.m_peakRssKilobytes = StatusField(status, "VmHWM:");
+        }
+    }
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    sample.m_heapBytes = info.uordblks + info.hblkhd;
+#elif defined(__GLIBC__)
+    struct mallinfo info = mallinfo(); // int fields, wrong past 2 GB
+    sample.m_heapBytes = static_cast<unsigned int>(info.uordblks) + static_cast<unsigned int>(info.hblkhd);
+#endif
+    return sample;
+}
+
+static const int numHardwareCounters = static_cast<int>(HardwareCounter::NumCounters);
+
+// One file descriptor per event, -1 for those that couldn't be opened
+static int hardwareCounterFds[numHardwareCounters] = { -1, -1, -1, -1 };
+static std::string hardwareCountersError; // why an event is missing, the first reason found
+
+void open_hardware_counters()
+{
+#ifdef __linux__
+    static const uint64_t events[numHardwareCounters] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    for (int counter = 0; counter < numHardwareCounters; counter++)
+    {
+        struct perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = events[counter];
+        attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attributes.inherit = 1;        // threads started later count into this one once they end
+        attributes.exclude_kernel = 1; // allowed with perf_event_paranoid up to 2
+        attributes.exclude_hv = 1;
+
+        hardwareCounterFds[counter] = syscall(__NR_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (hardwareCounterFds[counter] < 0 && hardwareCountersError.empty()) hardwareCountersError = strerror(errno);
+    }
+#else
+    hardwareCountersError = "perf_event_open is only on Linux";
+#endif
+}
+
+HardwareSample sample_hardware_counters()
+{
+    HardwareSample sample;
+    for (int counter = 0; counter < numHardwareCounters; counter++)
+    {
+        sample.m_counts[counter] = -1;
+        uint64_t values[3]; // value, time enabled, time running
+        if (hardwareCounterFds[counter] < 0 || read(hardwareCounterFds[counter], values, sizeof(values)) != sizeof(values)) continue;
+
+        // With more events than the PMU has counters the kernel takes turns, scale up to the whole time
+        if (values[2] == 0) continue;
+        sample.m_counts[counter] = values[2] < values[1] ? static_cast<int64_t>(values[0] * (static_cast<double>(values[1]) / values[2])) : values[0];
+    }
+    return sample;
+}
+
+void PhaseTimer::Record()
+{
+    m_running = false;
+    PhaseTotals& totals = phaseTotals[static_cast<int>(m_phase)];
+    totals.m_nanoseconds +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count() - m_excludedNanoseconds;
+    totals.m_items += m_items;
+    totals.m_runs++;
+
+    if (semant_hardware_counters)
+    {
+        HardwareSample endHardware = sample_hardware_counters();
+        for (int counter = 0; counter < numHardwareCounters; counter++)
+        {
+            if (endHardware.m_counts[counter] < 0 || m_startHardware.m_counts[counter] < 0) continue;
+            totals.m_hardwareCounts[counter] += endHardware.m_counts[counter] - m_startHardware.m_counts[counter];
+        }
+    }
+
+    MemorySample endMemory = sample_memory();
+    if (endMemory.m_rssKilobytes >= 0 && m_startMemory.m_rssKilobytes >= 0)
+    {
+        totals.m_rssAddedKilobytes += endMemory.m_rssKilobytes - m_startMemory.m_rssKilobytes;
+        AtomicMax(totals.m_maxRssKilobytes, endMemory.m_rssKilobytes);
+    }
+    if (endMemory.m_heapBytes >= 0 && m_startMemory.m_heapBytes >= 0)
+    {
+        totals.m_heapAddedBytes += endMemory.m_heapBytes - m_startMemory.m_heapBytes;
+        AtomicMax(totals.m_maxHeapBytes, endMemory.m_heapBytes);
+    }
+}
+
+// Kilobytes, or "-" for a value the system didn't give
+static std::string FormatKilobytes(int64_t kilobytes, bool available)
+{
+    return available ? std::to_string(kilobytes) : std::string("-");
+}
+
+// numerator / denominator * scale with two decimals, or "-" if either count is missing
+static std::string FormatRatio(int64_t numerator, int64_t denominator, double scale)
+{
+    if (numerator < 0 || denominator <= 0) return "-";
+    char ratio[32];
+    snprintf(ratio, sizeof(ratio), "%.2f", numerator * scale / denominator);
+    return ratio;
+}
+
+// The -H table. The miss rates are per thousand instructions, the one count every row has anyway.
+static std::string HardwareCountsTable()
+{
+    static const int cycles = static_cast<int>(HardwareCounter::Cycles);
+    static const int instructions = static_cast<int>(HardwareCounter::Instructions);
+    static const int cacheMisses = static_cast<int>(HardwareCounter::CacheMisses);
+    static const int branchMisses = static_cast<int>(HardwareCounter::BranchMisses);
+
+    int numAvailable = 0;
+    for (int counter = 0; counter < numHardwareCounters; counter++) numAvailable += hardwareCounterFds[counter] >= 0;
+    if (numAvailable == 0) return "hardware counters unavailable: " + hardwareCountersError + "\n";
+
+    char line[256];
+    snprintf(line, sizeof(line), "%-24s %16s %16s %7s %14s %11s %14s %11s\n", "phase", "cycles", "instructions", "IPC",
+        "cache misses", "per Kinstr", "branch misses", "per Kinstr");
+    std::string table = line;
+
+    auto addRow = [&](const char* name, const int64_t* counts) {
+        std::string values[numHardwareCounters];
+        for (int counter = 0; counter < numHardwareCounters; counter++)
+        {
+            values[counter] = hardwareCounterFds[counter] >= 0 ? std::to_string(counts[counter]) : std::string("-");
+        }
+        int64_t instructionCount = hardwareCounterFds[instructions] >= 0 ? counts[instructions] : -1;
+        snprintf(line, sizeof(line), "%-24s %16s %16s %7s %14s %11s %14s %11s\n", name, values[cycles].c_str(),
+            values[instructions].c_str(),
+            FormatRatio(instructionCount, hardwareCounterFds[cycles] >= 0 ? counts[cycles] : -1, 1).c_str(),
+            values[cacheMisses].c_str(),
+            FormatRatio(hardwareCounterFds[cacheMisses] >= 0 ? counts[cacheMisses] : -1, instructionCount, 1000).c_str(),
+            values[branchMisses].c_str(),
+            FormatRatio(hardwareCounterFds[branchMisses] >= 0 ? counts[branchMisses] : -1, instructionCount, 1000).c_str());
+        table += line;
+    };
+
+    for (int phase = 0; phase < static_cast<int>(SemantPhase::NumPhases); phase++)
+    {
+        const PhaseTotals& totals = phaseTotals[phase];
+        if (totals.m_runs == 0) continue;
+
+        int64_t counts[numHardwareCounters];
+        for (int counter = 0; counter < numHardwareCounters; counter++) counts[counter] = totals.m_hardwareCounts[counter];
+        addRow(phaseNames[phase], counts);
+    }
+
+    // since the counters were opened, threads that are still running not included
+    HardwareSample total = sample_hardware_counters();
+    addRow("total", total.m_counts);
+
+    if (numAvailable < numHardwareCounters) table += "some hardware counters unavailable: " + hardwareCountersError + "\n";
+    return table;
+}
+
+// Worker counts summed over every run of a scheduler with the same name, worker i of each run adds to entry i
+static std::mutex schedulerStatsMutex;
+static std::vector<std::pair<std::string, std::vector<WorkStealingScheduler::WorkerStats>>> schedulerStats;
+
+void record_scheduler_stats(const char* name, const WorkStealingScheduler& scheduler)
+{
+    std::lock_guard<std::mutex> lock(schedulerStatsMutex);
+    auto entry = std::find_if(schedulerStats.begin(), schedulerStats.end(),
+        [name](const std::pair<std::string, std::vector<WorkStealingScheduler::WorkerStats>>& stats) { return stats.first == name; });
+    if (entry == schedulerStats.end())
+    {
+        schedulerStats.emplace_back(name, std::vector<WorkStealingScheduler::WorkerStats>());
+        entry = schedulerStats.end() - 1;
+    }
+
+    const std::vector<WorkStealingScheduler::WorkerStats>& stats = scheduler.GetStats();
+    if (entry->second.size() < stats.size()) entry->second.resize(stats.size());
+    for (size_t worker = 0; worker < stats.size(); worker++)
+    {
+        entry->second[worker].m_tasksRun += stats[worker].m_tasksRun;
+        entry->second[worker].m_steals += stats[worker].m_steals;
+        entry->second[worker].m_failedSteals += stats[worker].m_failedSteals;
+    }
+}
+
+// The tasks every worker ran and how many of them it stole, a worker that steals a lot had too little to start with.
+// Empty if no scheduler ran.
+static std::string SchedulerStatsTable()
+{
+    std::lock_guard<std::mutex> lock(schedulerStatsMutex);
+    if (schedulerStats.empty()) return "";
+
+    char line[256];
+    snprintf(line, sizeof(line), "%-24s %8s %12s %12s %14s\n", "scheduler", "worker", "tasks", "steals", "failed steals");
+    std::string table = line;
+    for (const auto& entry : schedulerStats)
+    {
+        for (size_t worker = 0; worker < entry.second.size(); worker++)
+        {
+            const WorkStealingScheduler::WorkerStats& stats = entry.second[worker];
+            snprintf(line, sizeof(line), "%-24s %8zu %12d %12d %14d\n", entry.first.c_str(), worker, stats.m_tasksRun,
+                stats.m_steals, stats.m_failedSteals);
+            table += line;
+        }
+    }
+    return table;
+}
+
+void report_phase_times(ostream& stream)
+{
+    double totalMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - processStart).count();
+    double phaseMilliseconds = 0;
+
+    // Phases of files checked in parallel overlap, so with several workers the column can add up to more than the
+    // run. So can the memory they add, which is measured for the whole process.
+    char line[256];
+    snprintf(line, sizeof(line), "%-24s %12s %7s %12s %14s %12s %12s %12s %12s\n", "phase", "time (ms)", "%", "items",
+        "items/sec", "RSS +KB", "RSS max KB", "heap +KB", "heap max KB");
+    std::string table = line;
+    int64_t maxHeapBytes = -1;
+    for (int phase = 0; phase < static_cast<int>(SemantPhase::NumPhases); phase++)
+    {
+        const PhaseTotals& totals = phaseTotals[phase];
+        if (totals.m_runs == 0) continue;
+
+        double milliseconds = totals.m_nanoseconds / 1e6;
+        phaseMilliseconds += milliseconds;
+        char rate[32] = "-";
+        if (totals.m_items > 0 && totals.m_nanoseconds > 0) snprintf(rate, sizeof(rate), "%.0f", totals.m_items * 1e9 / totals.m_nanoseconds);
+        bool hasRss = totals.m_maxRssKilobytes >= 0;
+        bool hasHeap = totals.m_maxHeapBytes >= 0;
+        maxHeapBytes = std::max(maxHeapBytes, totals.m_maxHeapBytes.load());
+        snprintf(line, sizeof(line), "%-24s %12.3f %7.1f %12lld %14s %12s %12s %12s %12s\n", phaseNames[phase], milliseconds,
+            100.0 * milliseconds / totalMilliseconds, static_cast<long long>(totals.m_items.load()), rate,
+            FormatKilobytes(totals.m_rssAddedKilobytes, hasRss).c_str(), FormatKilobytes(totals.m_maxRssKilobytes, hasRss).c_str(),
+            FormatKilobytes(totals.m_heapAddedBytes / 1024, hasHeap).c_str(), FormatKilobytes(totals.m_maxHeapBytes / 1024, hasHeap).c_str());
+        table += line;
+    }
+
+    // whatever no phase covers: reading the flags, freeing the tree, exiting
+    double otherMilliseconds = std::max(0.0, totalMilliseconds - phaseMilliseconds);
+    snprintf(line, sizeof(line), "%-24s %12.3f %7.1f\n", "other", otherMilliseconds, 100.0 * otherMilliseconds / totalMilliseconds);
+    table += line;
+    snprintf(line, sizeof(line), "%-24s %12.3f %7.1f\n", "total", totalMilliseconds, 100.0);
+    table += line;
+
+    // The high-water mark of the resident set is kept by the kernel, the heap's is the most seen at a phase's end
+    MemorySample memory = sample_memory();
+    snprintf(line, sizeof(line), "peak RSS %s KB, peak heap at a phase boundary %s KB\n",
+        FormatKilobytes(memory.m_peakRssKilobytes, memory.m_peakRssKilobytes >= 0).c_str(),
+        FormatKilobytes(maxHeapBytes / 1024, maxHeapBytes >= 0).c_str());
+    table += line;
+
+    std::string schedulers = SchedulerStatsTable();
+    if (schedulers.empty() == false) table += "\n" + schedulers;
+    if (semant_hardware_counters) table += "\n" + HardwareCountsTable();
+    stream << table << std::flush;
+}
+
+// Indexed by SemantPhase
+static const AllocationSubsystem phaseSubsystems[] =
+{
+    AllocationSubsystem::AstConstruction, // parse, the string table entries are moved to interning as they are made
+    AllocationSubsystem::AstConstruction,
+    AllocationSubsystem::AstConstruction,
+    AllocationSubsystem::Hierarchy,
+    AllocationSubsystem::Hierarchy,
+    AllocationSubsystem::MethodTables,
+    AllocationSubsystem::MethodTables,
+    AllocationSubsystem::TypeEnvironment,
+    AllocationSubsystem::TypeEnvironment,
+    AllocationSubsystem::Output
+};
+static_assert(sizeof(phaseSubsystems) / sizeof(phaseSubsystems[0]) == static_cast<size_t>(SemantPhase::NumPhases),
+    "phaseSubsystems must have one subsystem per SemantPhase");
+
+void PhaseTimer::EnterSubsystem()
+{
+    m_charging = true;
+    m_previousSubsystem = set_allocation_subsystem(phaseSubsystems[static_cast<int>(m_phase)]);
+}
+
+void PhaseTimer::LeaveSubsystem()
+{
+    m_charging = false;
+    set_allocation_subsystem(m_previousSubsystem);
+}
@@ -0,0 +1,116 @@
+#ifndef PHASE_TIMER_H_
+#define PHASE_TIMER_H_
+
+// The phase times, memory samples and hardware counts -R and -H print, kept in phase-timer.cc
+
+#include <stdint.h>
+#include <chrono>
+#include "cool-io.h"
+#include "allocation-profile.h"
+
+class WorkStealingScheduler;
+
+extern int semant_phase_timing;
+
+// The phases -R times, in the order they run
+enum class SemantPhase : unsigned char
+{
+  Parse,
+  InstallBasicClasses,
+  InstallInterfaceClasses,
+  ValidateInheritance,
+  ClassGather,
+  MethodGather,
+  OverrideCheck,
+  AttributeGather,
+  FeatureCheck,
+  WriteTypedAst,
+  NumPhases
+};
+
+// Memory of the whole process, -1 where the system doesn't say
+struct MemorySample
+{
+  int64_t m_rssKilobytes = -1;     // VmRSS in /proc/self/status
+  int64_t m_peakRssKilobytes = -1; // VmHWM
+  int64_t m_heapBytes = -1;        // in use according to malloc, mapped blocks included
+};
+
+MemorySample sample_memory();
+
+extern int semant_hardware_counters;
+
+// The hardware events -H counts for the whole process, worker threads included
+enum class HardwareCounter : unsigned char
+{
+  Cycles,
+  Instructions,
+  CacheMisses,
+  BranchMisses,
+  NumCounters
+};
+
+struct HardwareSample
+{
+  int64_t m_counts[static_cast<int>(HardwareCounter::NumCounters)]; // -1 for an event that can't be counted
+};
+
+// Opens the counters, before any thread starts so that every thread is counted. Events the CPU, the kernel or its
+// perf_event_paranoid setting don't allow are left out and reported as such.
+void open_hardware_counters();
+
+HardwareSample sample_hardware_counters();
+
+// Times one run of a phase from construction until Stop, or destruction if Stop isn't called, and samples the
+// memory of the process at both ends. The totals are shared by every thread and printed by report_phase_times.
+// Without -R a timer is a flag test and nothing else. With -A the phase's allocations are charged to its
+// subsystem over the same span.
+class PhaseTimer
+{
+public:
+  explicit PhaseTimer(SemantPhase phase) : m_phase(phase), m_running(semant_phase_timing != 0)
+  {
+    if (semant_allocation_profile) EnterSubsystem();
+    if (m_running)
+    {
+      m_startMemory = sample_memory(); // before the clock starts, reading /proc is not part of the phase
+      if (semant_hardware_counters) m_startHardware = sample_hardware_counters();
+      m_start = std::chrono::steady_clock::now();
+    }
+  }
+  ~PhaseTimer() { Stop(); }
+
+  void AddItems(int64_t items) { m_items += items; }
+  // Leaves out time another phase's timer measured while this one was running, so it isn't counted twice
+  void Exclude(int64_t nanoseconds) { m_excludedNanoseconds += nanoseconds; }
+  void Stop() // later calls do nothing
+  {
+    if (m_running) Record();
+    if (m_charging) LeaveSubsystem();
+  }
+
+private:
+  void Record();
+  void EnterSubsystem();
+  void LeaveSubsystem();
+
+  SemantPhase m_phase;
+  bool m_running;
+  bool m_charging = false;
+  AllocationSubsystem m_previousSubsystem = AllocationSubsystem::Other;
+  int64_t m_items = 0;
+  int64_t m_excludedNanoseconds = 0;
+  MemorySample m_startMemory;
+  HardwareSample m_startHardware;
+  std::chrono::steady_clock::time_point m_start;
+};
+
+// Prints time, share of the whole run, items and items per second for every phase that ran, with what it added to
+// the resident set and the heap and the most either was at the end of a run of it, then the tasks and steals of
+// every scheduler worker. With -H a last table has the hardware counts of every phase.
+void report_phase_times(ostream& stream);
+
+// Adds the per worker counts of a scheduler that has finished running to the -R report under name, callable from any thread
+void record_scheduler_stats(const char* name, const WorkStealingScheduler& scheduler);
+
+#endif
@@ -1,23 +1,668 @@
 #include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <map>
+#include <algorithm>
+#include <set>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
 #include "cool-tree.h"
+#include "semant.h"
 
 extern int optind;  // used for option processing (man 3 getopt for more info)
 
 extern Program ast_root;      // root of the abstract syntax tree
 FILE *ast_file = stdin;       // we read the AST from standard input
 extern int ast_yyparse(void); // entry point to the AST parser
+extern std::string ast_parse_error; // why the last parse failed
 
 int cool_yydebug;     // not used, but needed to link with handle_flags
 char *curr_filename;
+extern char *semant_cache_dir;
+extern char *semant_export_file;
+extern char *semant_dependency_file;
+extern char *semant_affected_class;
+extern int semant_server;
+extern int semant_batch;
+extern int semant_watch;
+extern int semant_query;
+extern int semant_diagnostics_json;
+extern int semant_compact_output;
+extern int semant_binary_output;
+extern char *semant_decode_file;
+extern int semant_stream_output;
+extern int semant_list_bindings;
+extern int semant_phase_timing;
+extern int semant_cost_ranking;
+extern char *semant_cost_file;
+extern int semant_counters;
+extern char *semant_counters_file;
+extern int semant_jobs;
+extern char *semant_incremental_file;
+extern char *out_filename;
 
 void handle_flags(int argc, char *argv[]);
+extern void yyrestart(FILE *input_file); // restarts the AST lexer on a new input
+
+// ast_yyparse, timed as the parse phase with -R. False if the AST is malformed, ast_parse_error says why.
+static bool parse_ast() {
+  PhaseTimer timer(SemantPhase::Parse);
+  ast_root = NULL;
+  ast_parse_error.clear();
+  if (ast_yyparse() != 0 || ast_root == NULL) {
+    if (ast_parse_error.empty()) ast_parse_error = "Error in ast parsing\n";
+    return false;
+  }
+  if (semant_phase_timing) timer.AddItems(ast_root->get_classes()->len());
+  return true;
+}
+
+// For the modes that can't go on without a tree
+static void parse_ast_or_exit() {
+  if (!parse_ast()) {
+    cerr << ast_parse_error;
+    exit(1);
+  }
+}
+
+// Check a parsed program, collecting what a normal run writes to stderr and stdout
+static int check_parsed(Program program, std::string& diagnostics, std::string& output) {
+  SemantResult result = semant_program(program);
+  diagnostics = result.m_diagnostics;
+  output.clear();
+  if (result.m_errors) {
+    if (semant_diagnostics_json == 0) diagnostics += "Compilation halted due to static semantic errors.\n";
+  } else {
+    PhaseTimer writeTimer(SemantPhase::WriteTypedAst);
+    if (semant_binary_output) {
+      dump_binary_with_types(program, output);
+    } else {
+      TypedAstWriter writer(output, semant_compact_output);
+      program->dump_with_types(writer,0);
+    }
+    writeTimer.AddItems(output.size());
+  }
+  return result.m_errors;
+}
+
+// Parse the AST in ast_file and check it. -1 if the AST is malformed, then diagnostics holds the parse error.
+static int parse_and_check(std::string& diagnostics, std::string& output) {
+  yyrestart(ast_file);
+  if (!parse_ast()) {
+    diagnostics = ast_parse_error;
+    output.clear();
+    return -1;
+  }
+  return check_parsed(ast_root, diagnostics, output);
+}
+
+// Same for an AST held in memory
+static int check_program(std::string& input, std::string& diagnostics, std::string& output) {
+  FILE *input_file = fmemopen(&input[0], input.size(), "r");
+  ast_file = input_file != NULL ? input_file : stdin; // empty input, stdin is already at end of file
+  int errors = parse_and_check(diagnostics, output);
+  if (input_file != NULL) fclose(input_file);
+  return errors;
+}
+
+//
+// Batch mode checks every AST file named on the command line in this one process. With -j the files are spread
+// over that many worker threads (-j 0 uses every hardware thread) and each program is checked on a single
+// thread. Every worker checks with its own class table and type environments; what stays shared is the string
+// tables and the line stamp of new nodes, so parsing is serialized behind ast_mutex while checking and printing
+// run concurrently. Runs that write state files (-i, -E, -G) use one worker.
+//
+// Results are reported in command line order whatever order the files finish in: diagnostics go to stderr as
+// they would for separate runs, stdout gets one line per file with its parse and check time and a total at the
+// end, and with -o dir the typed AST of every error-free program is written to dir/<file name>.typed. The exit
+// status is 1 if any program had errors.
+//
+struct BatchFile {
+  bool m_opened = false;
+  int m_errors = 0;
+  std::string m_diagnostics;
+  double m_parseMilliseconds = 0;
+  double m_checkMilliseconds = 0;
+};
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int run_batch(int argc, char *argv[]) {
+  int numWorkers = semant_jobs;
+  if (semant_incremental_file != NULL || semant_export_file != NULL || semant_dependency_file != NULL ||
+      semant_affected_class != NULL) {
+    numWorkers = 1;
+  }
+  semant_jobs = 1;
+  initialize_semant();
+
+  std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+  std::vector<BatchFile> files(argc - optind);
+  WorkStealingScheduler scheduler(numWorkers);
+  scheduler.Run(files.size(), [&](int task, int worker) {
+    const char *filename = argv[optind + task];
+    BatchFile& file = files[task];
+
+    Program program = NULL;
+    {
+      std::lock_guard<std::mutex> lock(ast_mutex);
+      std::chrono::steady_clock::time_point parseStart = std::chrono::steady_clock::now();
+      ast_file = fopen(filename, "r");
+      if (ast_file == NULL) {
+        ast_file = stdin;
+        return;
+      }
+      yyrestart(ast_file);
+      if (parse_ast()) {
+        program = ast_root;
+      } else {
+        file.m_diagnostics = ast_parse_error;
+      }
+      fclose(ast_file);
+      ast_file = stdin;
+      file.m_parseMilliseconds = milliseconds_since(parseStart);
+    }
+    file.m_opened = true;
+    if (program == NULL) {
+      file.m_errors = 1;
+      return;
+    }
+
+    std::chrono::steady_clock::time_point checkStart = std::chrono::steady_clock::now();
+    std::string output;
+    file.m_errors = check_parsed(program, file.m_diagnostics, output);
+    if (!file.m_errors && out_filename != NULL) {
+      const char *baseName = strrchr(filename, '/');
+      std::string typedPath = std::string(out_filename) + "/" + (baseName != NULL ? baseName + 1 : filename) + ".typed";
+      std::ofstream typedFile(typedPath.c_str());
+      typedFile << output;
+    }
+    file.m_checkMilliseconds = milliseconds_since(checkStart);
+  });
+  if (semant_phase_timing) record_scheduler_stats("batch files", scheduler);
+
+  int failedFiles = 0;
+  cout << std::fixed << std::setprecision(2);
+  for (size_t i = 0; i < files.size(); i++) {
+    const char *filename = argv[optind + i];
+    if (!files[i].m_opened) {
+      cerr << "Could not open input ast file " << filename << endl;
+      failedFiles++;
+      continue;
+    }
+
+    cerr << files[i].m_diagnostics;
+    cout << filename << ": ";
+    if (files[i].m_errors) {
+      cout << files[i].m_errors << " errors";
+      failedFiles++;
+    } else {
+      cout << "ok";
+    }
+    cout << " (parse " << files[i].m_parseMilliseconds << " ms, check " << files[i].m_checkMilliseconds << " ms)" << endl;
+  }
+
+  cout << files.size() << " files, " << failedFiles << " failed, " << scheduler.GetNumWorkers() << " workers, "
+       << milliseconds_since(batchStart) << " ms" << endl;
+  return failedFiles ? 1 : 0;
+}
+
+//
+// Watch mode checks the COOL source files named on the command line, then waits for any of them to be saved and
+// checks the program again. A saved file goes through the lexer and parser in the current directory, as in
+// mysemant, while the other files keep their trees in memory. The check runs with an in-memory incremental state,
+// so the features of unchanged files whose dependencies did not change reuse their results from the previous
+// check and only the saved file's classes and the features that depend on them are checked again. Diagnostics
+// go to stderr followed by a status line. A file that fails to lex or parse keeps its last good tree.
+//
+// Every file's tree lives in its own pool, which is freed when the file parses again. The program that is checked
+// is built once, its class list holds an entry per file that is replaced in place, and the lists the class table
+// builds around it are freed after each check, so a long session doesn't grow with every save.
+//
+struct WatchedFile {
+  std::string m_path;
+  std::unique_ptr<AstPool> m_pool; // m_classes and the rest of the file's tree
+  Classes m_classes = NULL;        // NULL until the file has parsed once
+};
+
+// The classes of every watched file in command line order
+class WatchedClassList : public list_node<Class_> {
+public:
+  explicit WatchedClassList(size_t numFiles) : m_files(numFiles, NULL) {}
+
+  void SetFile(size_t file, Classes classes) { m_files[file] = classes; }
+
+  list_node<Class_> *copy_list() {
+    Classes copy = nil_Classes();
+    for (Classes classes : m_files) {
+      if (classes != NULL) copy = append_Classes(copy, classes->copy_list());
+    }
+    return copy;
+  }
+
+  int len() {
+    int length = 0;
+    for (Classes classes : m_files) {
+      if (classes != NULL) length += classes->len();
+    }
+    return length;
+  }
+
+  Class_ nth_length(int n, int &len) {
+    len = 0;
+    for (Classes classes : m_files) {
+      if (classes == NULL) continue;
+      int fileLength;
+      Class_ found = classes->nth_length(n - len, fileLength);
+      len += fileLength;
+      if (found != NULL) return found;
+    }
+    return NULL;
+  }
+
+  void dump(ostream& stream, int n) {
+    for (Classes classes : m_files) {
+      if (classes != NULL) classes->dump(stream, n);
+    }
+  }
+
+private:
+  std::vector<Classes> m_files;
+};
+
+// Run the front end on one source file and replace the file's tree, false if it failed
+static bool parse_source(WatchedFile& file) {
+  const std::string& path = file.m_path;
+  std::string quotedPath = "'";
+  for (char c : path) {
+    quotedPath += c == '\'' ? std::string("'\\''") : std::string(1, c);
+  }
+  quotedPath += "'";
+
+  std::string command = "./lexer " + quotedPath + " | ./parser " + quotedPath;
+  FILE *frontEnd = popen(command.c_str(), "r");
+  if (frontEnd == NULL) return false;
+
+  std::string ast;
+  char buffer[1 << 16];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), frontEnd)) > 0) {
+    ast.append(buffer, length);
+  }
+  if (pclose(frontEnd) != 0 || ast.empty()) return false;
+
+  ast_file = fmemopen(&ast[0], ast.size(), "r");
+  if (ast_file == NULL) {
+    ast_file = stdin;
+    return false;
+  }
+  std::unique_ptr<AstPool> pool(new AstPool);
+  bool parsed;
+  {
+    AstPool::Scope poolScope(pool.get());
+    yyrestart(ast_file);
+    parsed = parse_ast();
+  }
+  fclose(ast_file);
+  ast_file = stdin;
+  if (!parsed) {
+    cerr << ast_parse_error;
+    return false;
+  }
+
+  file.m_pool = std::move(pool); // frees the previous tree
+  file.m_classes = ast_root->get_classes();
+  return true;
+}
+
+static void check_watched(Program watchedProgram, IncrementalState& state) {
+  std::chrono::steady_clock::time_point checkStart = std::chrono::steady_clock::now();
+  SemantResult result;
+  {
+    AstPool pool; // the class table's lists
+    AstPool::Scope poolScope(&pool);
+    result = semant_program(watchedProgram, &state);
+  }
+
+  cerr << result.m_diagnostics;
+  cerr << std::fixed << std::setprecision(2) << "[semant] " << (result.m_errors ? std::to_string(result.m_errors) + " errors" : "ok")
+       << " (" << milliseconds_since(checkStart) << " ms)" << endl;
+}
+
+static int watch(int argc, char *argv[]) {
+  int inotifyFd = inotify_init1(IN_CLOEXEC);
+  if (inotifyFd < 0) {
+    cerr << "semant: could not start watching files" << endl;
+    return 1;
+  }
+
+  // Editors either rewrite a file in place or write a new file and rename it over the old one, so the
+  // directories are watched and their events matched against the watched names
+  std::vector<WatchedFile> files(argc - optind);
+  WatchedClassList watchedClasses(files.size());
+  std::map<std::pair<int, std::string>, int> watchedNames; // watch descriptor and file name to index into files
+  for (int i = optind; i < argc; i++) {
+    WatchedFile& file = files[i - optind];
+    file.m_path = argv[i];
+
+    size_t slash = file.m_path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : file.m_path.substr(0, slash + 1);
+    std::string name = slash == std::string::npos ? file.m_path : file.m_path.substr(slash + 1);
+    int watchDescriptor = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watchDescriptor < 0) {
+      cerr << "semant: could not watch " << file.m_path << endl;
+      return 1;
+    }
+    watchedNames[{ watchDescriptor, name }] = i - optind;
+
+    if (parse_source(file)) watchedClasses.SetFile(i - optind, file.m_classes);
+  }
+
+  initialize_semant();
+  Program watchedProgram = program(&watchedClasses);
+  IncrementalState state;
+  check_watched(watchedProgram, state);
+
+  alignas(struct inotify_event) char events[1 << 16];
+  for (;;) {
+    ssize_t length = read(inotifyFd, events, sizeof(events));
+    if (length < 0 && errno == EINTR) continue;
+    if (length <= 0) break;
+
+    std::set<int> changedFiles;
+    for (char *position = events; position < events + length; ) {
+      const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(position);
+      auto watched = event->len > 0 ? watchedNames.find({ event->wd, event->name }) : watchedNames.end();
+      if (watched != watchedNames.end()) changedFiles.insert(watched->second);
+      position += sizeof(struct inotify_event) + event->len;
+    }
+
+    bool anyParsed = false;
+    for (int changedFile : changedFiles) {
+      cerr << "[semant] " << files[changedFile].m_path << " changed" << endl;
+      if (parse_source(files[changedFile])) {
+        watchedClasses.SetFile(changedFile, files[changedFile].m_classes);
+        anyParsed = true;
+      }
+    }
+    if (anyParsed) check_watched(watchedProgram, state);
+  }
+
+  close(inotifyFd);
+  return 0;
+}
+
+//
+// Query mode checks the AST file named on the command line once, writes its diagnostics to stderr, and then
+// answers one JSON request per line of stdin with one JSON response per line of stdout until stdin is closed:
+//
+//   {"id":1,"method":"hover","file":"a.cl","line":12}         type of the outermost expression on the line,
+//                                                             and the kind and type of every expression on it
+//   {"id":2,"method":"definition","file":"a.cl","line":12}    where the methods, attributes, variables and classes
+//                                                             used on the line are defined
+//   {"id":3,"method":"callers","class":"A","name":"f"}        every dispatch that reaches A's f
+//
+// "file" is the filename the parser recorded for the class and may be left out to search every file. A program
+// with errors is still indexed, its expressions that could not be checked have a null type.
+//
+static int answer_queries(int argc, char *argv[]) {
+  if (optind < argc) {
+    ast_file = fopen(argv[optind], "r");
+    if (ast_file == NULL) {
+      cerr << "Could not open input ast file " << argv[optind] << endl;
+      return 1;
+    }
+  }
+  yyrestart(ast_file);
+  bool parsed = parse_ast();
+  if (ast_file != stdin) fclose(ast_file);
+  ast_file = stdin;
+  if (!parsed) {
+    cerr << ast_parse_error;
+    return 1;
+  }
+
+  SemantResult result = semant_program(ast_root);
+  cerr << result.m_diagnostics;
+  QueryIndex index(ast_root);
+
+  std::string request;
+  while (std::getline(std::cin, request)) {
+    if (request.empty()) continue;
+    cout << index.Answer(request) << '\n' << std::flush;
+  }
+  return 0;
+}
+
+//
+// Server mode answers check requests on stdin until stdin is closed or "quit" is read:
+//
+//   request:   check <length>\n<length bytes of AST text>
+//   response:  result <errors> <diagnostics length> <output length>\n<diagnostics><typed AST>
+//          or  error <message length>\n<message>
+//
+// The string tables, predefined symbols and basic classes stay warm from one request to the next, while each
+// request's tree, class lists, class table and identifiers are freed once its response is written. A request
+// line that is not understood or an AST that does not parse gets an error response and the server goes on with
+// the next line; a request cut short by the end of stdin gets one too, and then the server stops.
+//
+static void send_error(const std::string& message) {
+  cout << "error " << message.size() << "\n" << message;
+  cout.flush();
+}
+
+static void serve() {
+  initialize_semant();
+
+  std::string request;
+  while (std::getline(std::cin, request) && request != "quit") {
+    char command[8];
+    long long length = 0;
+    int numParsed = 0;
+    if (sscanf(request.c_str(), "%7s %lld%n", command, &length, &numParsed) != 2 || strcmp(command, "check") != 0 ||
+        length < 0 || request[numParsed] != '\0') {
+      send_error("expected \"check <length>\" or \"quit\"\n");
+      continue;
+    }
+
+    // Read in pieces so a wrong length costs no more memory than the bytes that actually arrive
+    std::string input;
+    char buffer[1 << 16];
+    size_t remaining = length;
+    while (remaining > 0 && std::cin.read(buffer, std::min(remaining, sizeof(buffer)))) {
+      input.append(buffer, std::cin.gcount());
+      remaining -= std::cin.gcount();
+    }
+    if (remaining > 0) {
+      send_error("request ended early\n");
+      return;
+    }
+
+    std::string diagnostics, output;
+    int errors;
+    {
+      AstPool pool;
+      AstPool::Scope poolScope(&pool);
+      errors = check_program(input, diagnostics, output);
+    }
+    if (errors < 0) {
+      send_error(diagnostics);
+      continue;
+    }
+    cout << "result " << errors << " " << diagnostics.size() << " " << output.size() << "\n" << diagnostics << output;
+    cout.flush();
+  }
+}
+
+// Prints a binary typed AST written with -b in the text format, the same bytes a run without -b prints, or with
+// -L its bindings as a run with -L and without -b lists them
+static int decode_binary_ast(const char *path) {
+  BinaryAst ast;
+  if (!ast.Load(path)) {
+    cerr << "Could not load binary typed AST " << path << endl;
+    return 1;
+  }
+  if (semant_list_bindings) {
+    ast.WriteBindings(cout);
+    return cout.flush() ? 0 : 1;
+  }
+  TypedAstWriter writer(STDOUT_FILENO, semant_compact_output);
+  ast.DumpWithTypes(writer);
+  return writer.Flush() ? 0 : 1;
+}
+
+//
+// With -P the typed AST is written one class at a time, each class as soon as all of its features have been
+// checked while later classes are still being checked. The classes come out in program order, so the stream is
+// what a normal run prints followed by a trailer line "_end", which is only written once the whole program is
+// known to be free of errors. A consumer that starts on the classes as they arrive has to throw them away if the
+// stream ends without the trailer.
+//
+static int stream_typed_classes() {
+  parse_ast_or_exit();
+
+  TypedAstWriter writer(STDOUT_FILENO, semant_compact_output);
+  writer.WriteLineNumber(0, ast_root->get_line_number());
+  writer.WriteLine(0, "_program");
+  writer.Flush();
+
+  SemantResult result = semant_program(ast_root, nullptr, [&](Class_ checkedClass) {
+    PhaseTimer writeTimer(SemantPhase::WriteTypedAst);
+    size_t bytesBefore = writer.GetNumBytes();
+    checkedClass->dump_with_types(writer, 2);
+    writer.Flush();
+    writeTimer.AddItems(writer.GetNumBytes() - bytesBefore);
+  });
+
+  cerr << result.m_diagnostics;
+  if (result.m_errors) {
+    if (semant_diagnostics_json == 0) cerr << "Compilation halted due to static semantic errors." << endl;
+    return 1;
+  }
+  writer.WriteLine(0, "_end");
+  return writer.Flush() ? 0 : 1;
+}
+
+static void print_phase_times() {
+  report_phase_times(cerr);
+}
+
+static void print_check_costs() {
+  if (semant_cost_ranking > 0) report_check_costs(cerr, semant_cost_ranking);
+  if (semant_cost_file != NULL && !write_check_costs(semant_cost_file)) {
+    cerr << "Could not write cost file " << semant_cost_file << endl;
+  }
+}
+
+static void print_allocations() {
+  report_allocations(cerr);
+}
+
+static void print_counters() {
+  if (strcmp(semant_counters_file, "-") == 0) {
+    dump_counters(cerr);
+    return;
+  }
+  std::ofstream file(semant_counters_file);
+  dump_counters(file);
+  if (!file) {
+    cerr << "Could not write counters file " << semant_counters_file << endl;
+  }
+}
 
 int main(int argc, char *argv[]) {
   //Used to parse input from standard input
   handle_flags(argc,argv);
-  ast_yyparse();
+
+  if (semant_hardware_counters) {
+    open_hardware_counters();
+  }
+  if (semant_phase_timing) {
+    atexit(print_phase_times);
+  }
+  if (semant_cost_ranking > 0 || semant_cost_file != NULL) {
+    atexit(print_check_costs);
+  }
+  if (semant_counters) {
+    atexit(print_counters);
+  }
+  if (semant_allocation_profile) {
+    atexit(print_allocations);
+  }
+
+  if (semant_decode_file != NULL) {
+    return decode_binary_ast(semant_decode_file);
+  }
+
+  if (semant_server) {
+    serve();
+    return 0;
+  }
+
+  if (semant_batch) {
+    return run_batch(argc, argv);
+  }
+
+  if (semant_watch) {
+    return watch(argc, argv);
+  }
+
+  if (semant_query) {
+    return answer_queries(argc, argv);
+  }
+
+  if (semant_stream_output) {
+    return stream_typed_classes();
+  }
+
+  // Exporting an interface or dependency graph or listing affected features is a side effect a cache hit would
+  // skip, so those runs always check, and the cache only holds typed ASTs, not -L listings
+  if (semant_cache_dir != NULL && semant_export_file == NULL && semant_dependency_file == NULL &&
+      semant_affected_class == NULL && !semant_list_bindings) {
+    // The key is a hash of the input text, so a cache hit replays the stored diagnostics and typed AST without
+    // even parsing. A miss parses the text that was read, checks as usual and stores the result.
+    std::string input;
+    char buffer[1 << 16];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+      input.append(buffer, length);
+    }
+
+    SemantResultCache cache(semant_cache_dir);
+    uint64_t key = cache.ComputeKey(input);
+    int errors = 0;
+    if (!cache.Replay(key, input, errors)) {
+      std::string diagnostics, output;
+      errors = check_program(input, diagnostics, output);
+      if (errors >= 0) cache.Store(key, input, diagnostics, output, errors); // a malformed AST is not checked at all
+      cerr << diagnostics;
+      cout << output;
+    }
+    exit(errors ? 1 : 0);
+  }
+
+  parse_ast_or_exit();
   ast_root->semant();
-  ast_root->dump_with_types(cout,0);
+  PhaseTimer writeTimer(SemantPhase::WriteTypedAst);
+  if (semant_list_bindings) {
+    write_bindings(ast_root, cout);
+  } else if (semant_binary_output) {
+    std::string output;
+    dump_binary_with_types(ast_root, output);
+    fwrite(output.data(), 1, output.size(), stdout);
+    writeTimer.AddItems(output.size());
+  } else {
+    TypedAstWriter writer(STDOUT_FILENO, semant_compact_output);
+    ast_root->dump_with_types(writer,0);
+    writer.Flush();
+    writeTimer.AddItems(writer.GetNumBytes());
+  }
+  writeTimer.Stop();
 
   // Used to parse input from a file on command line
   // if (optind < argc) {
@@ -7,9 +7,38 @@
 #include <set>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <new>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 extern int semant_debug;
+extern int semant_jobs;
+extern std::vector<const char*> semant_interface_files;
+extern char *semant_export_file;
+extern char *semant_dependency_file;
+extern char *semant_affected_class;
+extern int node_lineno;
+extern char *semant_incremental_file;
 extern char *curr_filename;
+extern int semant_max_errors;
+extern int semant_diagnostics_json;
+extern int semant_compact_output;
+extern int semant_binary_output;
+extern int semant_cost_ranking;
+extern char *semant_cost_file;
+
+std::mutex ast_mutex;
 
 //////////////////////////////////////////////////////////////////////
 //
@@ -52,6 +81,11 @@ static Symbol
 //
 static void initialize_constants(void)
 {
+    // The symbols live as long as the string tables, every program checked by this process shares them
+    static bool initialized = false;
+    if (initialized) return;
+    initialized = true;
+
     arg         = idtable.add_string("arg");
     arg2        = idtable.add_string("arg2");
     Bool        = idtable.add_string("Bool");
@@ -82,6 +116,573 @@ static void initialize_constants(void)
     val         = idtable.add_string("_val");
 }
 
+WorkStealingScheduler::WorkStealingScheduler(int numWorkers)
+{
+    if (numWorkers <= 0)
+    {
+        numWorkers = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (int i = 0; i < numWorkers; i++)
+    {
+        m_queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    m_stats.resize(numWorkers);
+}
+
+void WorkStealingScheduler::Run(int numTasks, const std::function<void(int, int)>& work)
+{
+    // Deal the tasks out in contiguous blocks so a worker's tasks start out next to each other in the AST,
+    // a worker that finishes its block early steals from the others
+    int numWorkers = GetNumWorkers();
+    for (int worker = 0; worker < numWorkers; worker++)
+    {
+        int begin = static_cast<int>(static_cast<long long>(numTasks) * worker / numWorkers);
+        int end = static_cast<int>(static_cast<long long>(numTasks) * (worker + 1) / numWorkers);
+        for (int task = begin; task < end; task++)
+        {
+            m_queues[worker]->m_tasks.push_back(task);
+        }
+    }
+
+    if (numWorkers == 1)
+    {
+        RunWorker(0, work);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (int worker = 1; worker < numWorkers; worker++)
+    {
+        threads.emplace_back([this, worker, &work]() { RunWorker(worker, work); });
+    }
+    RunWorker(0, work);
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void WorkStealingScheduler::RunWorker(int worker, const std::function<void(int, int)>& work)
+{
+    WorkerStats& stats = m_stats[worker];
+    int numWorkers = GetNumWorkers();
+
+    while (true)
+    {
+        int task = -1;
+
+        // Newest task from our own queue first
+        {
+            WorkerQueue& ownQueue = *m_queues[worker];
+            std::lock_guard<std::mutex> lock(ownQueue.m_mutex);
+            if (ownQueue.m_tasks.empty() == false)
+            {
+                task = ownQueue.m_tasks.back();
+                ownQueue.m_tasks.pop_back();
+            }
+        }
+
+        // Otherwise steal the oldest task from the next worker that has any. No tasks are added
+        // once Run has started, so when every queue is empty there is nothing left to do.
+        for (int offset = 1; task == -1 && offset < numWorkers; offset++)
+        {
+            WorkerQueue& victimQueue = *m_queues[(worker + offset) % numWorkers];
+            std::lock_guard<std::mutex> lock(victimQueue.m_mutex);
+            if (victimQueue.m_tasks.empty() == false)
+            {
+                task = victimQueue.m_tasks.front();
+                victimQueue.m_tasks.pop_front();
+                stats.m_steals++;
+            }
+            else
+            {
+                stats.m_failedSteals++;
+            }
+        }
+
+        if (task == -1) return;
+
+        work(task, worker);
+        stats.m_tasksRun++;
+    }
+}
+
+thread_local AstPool* AstPool::current = nullptr;
+
+AstPool::~AstPool()
+{
+    for (char* block : m_blocks) delete[] block;
+}
+
+void* AstPool::Allocate(size_t size)
+{
+    const size_t alignment = alignof(std::max_align_t);
+    size = (size + alignment - 1) / alignment * alignment;
+
+    // A node bigger than a block gets a block of its own, put before the last so the rest of that is still used
+    if (size > blockSize)
+    {
+        char* block = new char[size];
+        m_blocks.insert(m_blocks.empty() ? m_blocks.end() : m_blocks.end() - 1, block);
+        return block;
+    }
+
+    if (blockSize - m_used < size)
+    {
+        m_blocks.push_back(new char[blockSize]);
+        m_used = 0;
+    }
+    void* memory = m_blocks.back() + m_used;
+    m_used += size;
+    return memory;
+}
+
+void* operator new(size_t size, AstPool* pool)
+{
+    return pool != nullptr ? pool->Allocate(size) : ::operator new(size);
+}
+
+void operator delete(void* memory, AstPool* pool)
+{
+    // the pool frees its memory all at once
+    if (pool == nullptr) ::operator delete(memory);
+}
+
+// FNV-1a, only used to fingerprint source text so it does not need to be cryptographic
+static const uint64_t hashOffsetBasis = 14695981039346656037ULL;
+
+static uint64_t HashBytes(const char* bytes, size_t length, uint64_t hash = hashOffsetBasis)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= static_cast<unsigned char>(bytes[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t HashString(const std::string& text, uint64_t hash = hashOffsetBasis)
+{
+    return HashBytes(text.data(), text.size(), hash);
+}
+
+// Hashes a sequence of symbols and numbers, each symbol followed by a NUL so that adjacent names can't run together
+class ShapeHasher
+{
+public:
+    void AddSymbol(Symbol symbol)
+    {
+        const char* text = symbol != nullptr ? symbol->get_string() : "";
+        m_hash = HashBytes(text, strlen(text) + 1, m_hash);
+    }
+
+    void AddNumber(int64_t number)
+    {
+        m_hash = HashBytes(reinterpret_cast<const char*>(&number), sizeof(number), m_hash);
+    }
+
+    uint64_t GetHash() const { return m_hash; }
+
+private:
+    uint64_t m_hash = hashOffsetBasis;
+};
+
+// Every expression of a feature body in pre-order, the order FeatureResult annotations are stored in. parents
+// optionally receives the pre-order index of each expression's parent, -1 for the root.
+static void CollectExpressions(Expression root, std::vector<Expression>& expressions, std::vector<int>* parents = nullptr)
+{
+    std::vector<std::pair<Expression, int>> stack = { { root, -1 } };
+    while (stack.empty() == false)
+    {
+        Expression expression = stack.back().first;
+        if (parents != nullptr) parents->push_back(stack.back().second);
+        stack.pop_back();
+        int index = expressions.size();
+        expressions.push_back(expression);
+
+        // Children are pushed last to first so that they are visited first to last
+        std::vector<Expression> children;
+        switch(expression->get_expr_type())
+        {
+            case ExpressionType::Assign:
+                children.push_back(static_cast<assign_class*>(expression)->get_expr());
+                break;
+            case ExpressionType::Dispatch:
+            case ExpressionType::StaticDispatch:
+            {
+                children.push_back(expression->get_dispatch_id_expr());
+                Expressions actuals = expression->get_dispatch_param_expressions();
+                for(int i = actuals->first(); actuals->more(i); i = actuals->next(i)) children.push_back(actuals->nth(i));
+                break;
+            }
+            case ExpressionType::Conditional:
+            {
+                cond_class* conditional = static_cast<cond_class*>(expression);
+                children = { conditional->get_pred(), conditional->get_then(), conditional->get_else() };
+                break;
+            }
+            case ExpressionType::Loop:
+            {
+                loop_class* loopExpr = static_cast<loop_class*>(expression);
+                children = { loopExpr->get_pred(), loopExpr->get_body() };
+                break;
+            }
+            case ExpressionType::TypeCase:
+            {
+                typcase_class* typecaseExpr = static_cast<typcase_class*>(expression);
+                children.push_back(typecaseExpr->get_case_expr());
+                Cases cases = typecaseExpr->get_cases();
+                for(int i = cases->first(); cases->more(i); i = cases->next(i)) children.push_back(static_cast<branch_class*>(cases->nth(i))->get_expr());
+                break;
+            }
+            case ExpressionType::Block:
+            {
+                Expressions body = static_cast<block_class*>(expression)->get_body();
+                for(int i = body->first(); body->more(i); i = body->next(i)) children.push_back(body->nth(i));
+                break;
+            }
+            case ExpressionType::Let:
+            {
+                let_class* letExpr = static_cast<let_class*>(expression);
+                children = { letExpr->get_let_init(), letExpr->get_let_body() };
+                break;
+            }
+            case ExpressionType::Plus:
+            case ExpressionType::Sub:
+            case ExpressionType::Mul:
+            case ExpressionType::Divide:
+            case ExpressionType::Lt:
+            case ExpressionType::Eq:
+            case ExpressionType::Leq:
+                children = { expression->get_lhs(), expression->get_rhs() };
+                break;
+            case ExpressionType::Neg:
+            case ExpressionType::Comp:
+            case ExpressionType::IsVoid:
+                children.push_back(expression->get_rhs());
+                break;
+            default:
+                break; // constants, new, object and no_expr have no children
+        }
+        for (auto child = children.rbegin(); child != children.rend(); ++child)
+        {
+            stack.push_back({ *child, index });
+        }
+    }
+}
+
+// State file layout, one record per feature:
+//   feature <class name> <feature name> <attr or method> <fingerprint> <local slots> <#dependencies> <#annotations> <#diagnostics>
+//   <class name> <signature hash>         (one line per dependency)
+//   <type or -> <binding kind> <index>     (one line per annotation)
+//   <line> <code> <filename length> <message length>\n<filename><message>   (one line per diagnostic)
+static const char* incrementalStateHeader = "cool-semant-incremental 3";
+
+bool IncrementalState::Load(const char* path)
+{
+    m_results.clear();
+
+    std::ifstream stream(path, std::ios::binary);
+    std::string header;
+    if (!std::getline(stream, header) || header != incrementalStateHeader)
+    {
+        return false; // first run or a state file from another version, everything gets checked
+    }
+
+    std::map<std::string, Symbol> typeSymbols; // idtable lookups are linear, intern each type name once
+
+    std::string tag;
+    while (stream >> tag)
+    {
+        FeatureResult result;
+        std::string featureKind;
+        int numDependencies = 0;
+        int numAnnotations = 0;
+        int numDiagnostics = 0;
+        if (tag != "feature" ||
+            !(stream >> result.m_className >> result.m_featureName >> featureKind >> result.m_fingerprint >> result.m_localSlots >>
+              numDependencies >> numAnnotations >> numDiagnostics))
+        {
+            m_results.clear();
+            return false;
+        }
+
+        for (int i = 0; i < numDependencies; i++)
+        {
+            std::string className;
+            uint64_t signature = 0;
+            stream >> className >> signature;
+            result.m_dependencies.push_back({ className, signature });
+        }
+
+        for (int i = 0; i < numAnnotations; i++)
+        {
+            std::string typeName;
+            int kind = 0;
+            FeatureResult::Annotation annotation;
+            stream >> typeName >> kind >> annotation.m_binding.index;
+            if (typeName != "-")
+            {
+                Symbol& typeSymbol = typeSymbols[typeName];
+                if (typeSymbol == nullptr) typeSymbol = idtable.add_string(const_cast<char*>(typeName.c_str()));
+                annotation.m_type = typeSymbol;
+            }
+            annotation.m_binding.kind = static_cast<BindingKind>(kind);
+            result.m_annotations.push_back(annotation);
+        }
+
+        for (int i = 0; i < numDiagnostics && stream; i++)
+        {
+            Diagnostic diagnostic;
+            int code = 0;
+            size_t filenameLength = 0;
+            size_t messageLength = 0;
+            stream >> diagnostic.m_line >> code >> filenameLength >> messageLength;
+            stream.get(); // newline before the text
+            diagnostic.m_code = static_cast<DiagnosticCode>(code);
+            diagnostic.m_filename.resize(filenameLength);
+            diagnostic.m_message.resize(messageLength);
+            if (filenameLength > 0) stream.read(&diagnostic.m_filename[0], filenameLength);
+            if (messageLength > 0) stream.read(&diagnostic.m_message[0], messageLength);
+            result.m_diagnostics.push_back(std::move(diagnostic));
+        }
+
+        if (!stream)
+        {
+            m_results.clear();
+            return false;
+        }
+        result.m_isAttribute = featureKind == "attr";
+        Add(result);
+    }
+
+    return true;
+}
+
+bool IncrementalState::Save(const char* path) const
+{
+    // Write next to the old state and swap it in so an interrupted run never leaves a truncated file behind
+    std::string temporaryPath = std::string(path) + ".tmp";
+    std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+    stream << incrementalStateHeader << "\n";
+
+    for (const auto& entry : m_results)
+    {
+        const FeatureResult& result = entry.second;
+        stream << "feature " << result.m_className << " " << result.m_featureName << " " << (result.m_isAttribute ? "attr" : "method")
+               << " " << result.m_fingerprint << " " << result.m_localSlots << " " << result.m_dependencies.size() << " "
+               << result.m_annotations.size() << " " << result.m_diagnostics.size() << "\n";
+
+        for (const std::pair<std::string, uint64_t>& dependency : result.m_dependencies)
+        {
+            stream << dependency.first << " " << dependency.second << "\n";
+        }
+
+        for (const FeatureResult::Annotation& annotation : result.m_annotations)
+        {
+            stream << (annotation.m_type != nullptr ? annotation.m_type->get_string() : "-") << " "
+                   << static_cast<int>(annotation.m_binding.kind) << " " << annotation.m_binding.index << "\n";
+        }
+
+        for (const Diagnostic& diagnostic : result.m_diagnostics)
+        {
+            stream << diagnostic.m_line << " " << static_cast<int>(diagnostic.m_code) << " " << diagnostic.m_filename.size() << " "
+                   << diagnostic.m_message.size() << "\n" << diagnostic.m_filename << diagnostic.m_message << "\n";
+        }
+    }
+
+    stream.close();
+    if (!stream) return false;
+
+    return rename(temporaryPath.c_str(), path) == 0;
+}
+
+const FeatureResult* IncrementalState::Find(const std::string& className, const std::string& featureName, bool isAttribute) const
+{
+    auto found = m_results.find({ className, featureName, isAttribute });
+    return found != m_results.end() ? &found->second : nullptr;
+}
+
+// Bump whenever the entry layout or what the cached diagnostics and typed AST look like changes
+static const char* semantCacheFormat = "cool-semant-cache 3";
+
+// The format and a hash of the running executable, so an entry is only replayed by the same build of the compiler
+// whatever file the change was in, while rebuilding identical sources keeps the entries. Empty if the executable
+// can't be read, the cache is then not used.
+static const std::string& CacheVersion()
+{
+    static const std::string version = [] {
+        int fd = open("/proc/self/exe", O_RDONLY);
+        if (fd < 0) return std::string();
+        struct stat fileStat;
+        void* mapping = MAP_FAILED;
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+        {
+            mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (mapping == MAP_FAILED) return std::string();
+
+        // a word at a time, the executable is megabytes and this runs on every cached check
+        const char* bytes = static_cast<const char*>(mapping);
+        size_t length = fileStat.st_size;
+        uint64_t hash = hashOffsetBasis;
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t))
+        {
+            uint64_t word;
+            memcpy(&word, bytes + i, sizeof(word));
+            hash = (hash ^ word) * 1099511628211ULL;
+            hash ^= hash >> 29;
+        }
+        hash = HashBytes(bytes + i, length - i, hash);
+        munmap(mapping, length);
+
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+        return std::string(semantCacheFormat) + " " + hex;
+    }();
+    return version;
+}
+
+SemantResultCache::SemantResultCache(const char* directory) : m_directory(directory)
+{
+    // the flags that change how the diagnostics and the typed AST are written
+    m_context = std::to_string(semant_max_errors) + (semant_diagnostics_json ? " json" : " text") +
+        (semant_compact_output ? " compact" : "") + (semant_binary_output ? " binary" : "") + "\n";
+
+    // and every imported class interface, by name and contents
+    for (const char* path : semant_interface_files)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        std::ostringstream contents;
+        contents << stream.rdbuf();
+        m_context += std::string(path) + "\n" + std::to_string(contents.str().size()) + "\n" + contents.str();
+    }
+}
+
+uint64_t SemantResultCache::ComputeKey(const std::string& input) const
+{
+    return HashString(input, HashString(m_context, HashString(CacheVersion())));
+}
+
+std::string SemantResultCache::GetPath(uint64_t key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.semant", static_cast<unsigned long long>(key));
+    return m_directory + "/" + name;
+}
+
+static bool WriteAll(int fd, const char* bytes, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return true;
+}
+
+// Entry layout: a header line "<cache version>\n<errors> <context length> <input length> <diagnostics length>
+// <output length>\n" followed by the flags and interfaces, the input, and the diagnostics and typed AST exactly as
+// they are written to stderr and stdout
+bool SemantResultCache::Replay(uint64_t key, const std::string& input, int& errors) const
+{
+    const std::string& version = CacheVersion();
+    if (version.empty()) return false;
+
+    int fd = open(GetPath(key).c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t fileSize = fileStat.st_size;
+    void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return false;
+
+    const char* bytes = static_cast<const char*>(mapping);
+    size_t versionLength = version.size();
+    const char* sizesLine = bytes + versionLength + 1;
+    const char* sizesEnd = sizesLine < bytes + fileSize ? static_cast<const char*>(memchr(sizesLine, '\n', bytes + fileSize - sizesLine)) : nullptr;
+
+    bool hit = false;
+    if (fileSize > versionLength && memcmp(bytes, version.data(), versionLength) == 0 && bytes[versionLength] == '\n' && sizesEnd != nullptr)
+    {
+        std::string sizes(sizesLine, sizesEnd);
+        unsigned long long contextLength = 0;
+        unsigned long long inputLength = 0;
+        unsigned long long diagnosticsLength = 0;
+        unsigned long long outputLength = 0;
+        const char* context = sizesEnd + 1;
+        size_t headerLength = context - bytes;
+        if (sscanf(sizes.c_str(), "%d %llu %llu %llu %llu", &errors, &contextLength, &inputLength, &diagnosticsLength, &outputLength) == 5 &&
+            contextLength == m_context.size() && inputLength == input.size() &&
+            headerLength + contextLength + inputLength + diagnosticsLength + outputLength == fileSize)
+        {
+            // the key is only a hash, the entry is for this run if what it was computed from is the same
+            const char* entryInput = context + contextLength;
+            const char* diagnostics = entryInput + inputLength;
+            if (memcmp(context, m_context.data(), contextLength) == 0 && memcmp(entryInput, input.data(), inputLength) == 0)
+            {
+                cout.flush();
+                WriteAll(STDERR_FILENO, diagnostics, diagnosticsLength);
+                WriteAll(STDOUT_FILENO, diagnostics + diagnosticsLength, outputLength);
+                hit = true;
+            }
+        }
+    }
+
+    munmap(mapping, fileSize);
+    return hit;
+}
+
+bool SemantResultCache::Store(uint64_t key, const std::string& input, const std::string& diagnostics, const std::string& output, int errors) const
+{
+    const std::string& version = CacheVersion();
+    if (version.empty()) return false;
+
+    mkdir(m_directory.c_str(), 0777); // may already exist
+
+    // Several compilers can share the cache directory, write a private file and move it into place
+    std::string path = GetPath(key);
+    std::string temporaryPath = path + ".tmp." + std::to_string(getpid());
+    {
+        std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+        stream << version << "\n" << errors << " " << m_context.size() << " " << input.size() << " " << diagnostics.size()
+               << " " << output.size() << "\n";
+        stream.write(m_context.data(), m_context.size());
+        stream.write(input.data(), input.size());
+        stream.write(diagnostics.data(), diagnostics.size());
+        stream.write(output.data(), output.size());
+        stream.close();
+        if (!stream)
+        {
+            unlink(temporaryPath.c_str());
+            return false;
+        }
+    }
+
+    if (rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        unlink(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
 const InheritanceNode* InheritanceNode::FirstCommonAncestor(const InheritanceNode* otherNode) const
 {
     using namespace std;
@@ -167,20 +768,36 @@ bool InheritanceNode::AddChild(InheritanceNode *newChild, std::string &errorStri
 }
 
 // todo: Might want to get rid of this copy to m_classes
-ClassTable::ClassTable(Classes classes) : semant_errors(0) , error_stream(cerr), m_classes(classes) {
+ClassTable::ClassTable(Classes classes, ostream& errorStream, IncrementalState* incrementalState,
+    const ClassCheckedCallback& onClassChecked)
+    : semant_errors(0) , error_stream(errorStream), m_classes(classes), m_incrementalState(incrementalState),
+      m_onClassChecked(onClassChecked) {
+    PhaseTimer basicClassesTimer(SemantPhase::InstallBasicClasses);
     install_basic_classes();
+    basicClassesTimer.Stop();
+
+    PhaseTimer interfaceTimer(SemantPhase::InstallInterfaceClasses);
+    install_interface_classes();
+    interfaceTimer.AddItems(m_interfaceClasses.size());
+    interfaceTimer.Stop();
+
+    PhaseTimer inheritanceTimer(SemantPhase::ValidateInheritance);
+    bool inheritanceValid = ValidateInheritance();
+    inheritanceTimer.AddItems(m_inheritanceNodeMap.size());
+    inheritanceTimer.Stop();
 
-    if (ValidateInheritance())
+    if (inheritanceValid)
     {
         CheckTypes();
     }
 }
 
-void ClassTable::install_basic_classes() {
+static Classes create_basic_classes(Symbol basicClassFilename) {
+    AstPool::Scope heap(nullptr);	// shared by every class table, whatever pool the first one was built in
+    Classes basicClasses = nil_Classes();
 
     // The tree package uses these globals to annotate the classes built below.
    // curr_lineno  = 0;
-    m_basicClassFilename = stringtable.add_string("<basic class>");
 
     // The following demonstrates how to create dummy parse trees to
     // refer to basic Cool classes.  There's no need for method
@@ -210,8 +827,8 @@ void ClassTable::install_basic_classes() {
 					       single_Features(method(cool_abort, nil_Formals(), Object, no_expr())),
 					       single_Features(method(type_name, nil_Formals(), Str, no_expr()))),
 			       single_Features(method(copy, nil_Formals(), SELF_TYPE, no_expr()))),
-	       m_basicClassFilename);
-    m_classes = append_Classes(m_classes, single_Classes(Object_class));
+	       basicClassFilename);
+    basicClasses = append_Classes(basicClasses, single_Classes(Object_class));
 
     //
     // The IO class inherits from Object. Its methods are
@@ -232,8 +849,8 @@ void ClassTable::install_basic_classes() {
 										      SELF_TYPE, no_expr()))),
 					       single_Features(method(in_string, nil_Formals(), Str, no_expr()))),
 			       single_Features(method(in_int, nil_Formals(), Int, no_expr()))),
-	       m_basicClassFilename);
-    m_classes = append_Classes(m_classes, single_Classes(IO_class));
+	       basicClassFilename);
+    basicClasses = append_Classes(basicClasses, single_Classes(IO_class));
 
     //
     // The Int class has no methods and only a single attribute, the
@@ -243,15 +860,15 @@ void ClassTable::install_basic_classes() {
 	class_(Int,
 	       Object,
 	       single_Features(attr(val, prim_slot, no_expr())),
-	       m_basicClassFilename);
-    m_classes = append_Classes(m_classes, single_Classes(Int_class));
+	       basicClassFilename);
+    basicClasses = append_Classes(basicClasses, single_Classes(Int_class));
 
     //
     // Bool also has only the "val" slot.
     //
     Class_ Bool_class =
-	class_(Bool, Object, single_Features(attr(val, prim_slot, no_expr())),m_basicClassFilename);
-    m_classes = append_Classes(m_classes, single_Classes(Bool_class));
+	class_(Bool, Object, single_Features(attr(val, prim_slot, no_expr())),basicClassFilename);
+    basicClasses = append_Classes(basicClasses, single_Classes(Bool_class));
 
     //
     // The class Str has a number of slots and operations:
@@ -280,34 +897,355 @@ void ClassTable::install_basic_classes() {
 								     single_Formals(formal(arg2, Int))),
 						      Str,
 						      no_expr()))),
-	       m_basicClassFilename);
-    m_classes = append_Classes(m_classes, single_Classes(Str_class));
+	       basicClassFilename);
+    basicClasses = append_Classes(basicClasses, single_Classes(Str_class));
+    return basicClasses;
 }
 
-bool ClassTable::ValidateInheritance()
+// The basic classes never change and checking never writes to them, so they are built once per process and
+// shared by every class table
+static const Classes& shared_basic_classes(Symbol& basicClassFilename) {
+    static const Symbol filename = stringtable.add_string("<basic class>");
+    static const Classes basicClasses = create_basic_classes(filename);
+
+    basicClassFilename = filename;
+    return basicClasses;
+}
+
+void ClassTable::install_basic_classes() {
+    std::lock_guard<std::mutex> lock(ast_mutex);
+    m_classes = append_Classes(m_classes, shared_basic_classes(m_basicClassFilename));
+}
+
+//
+// Class interface files let a program be checked against classes that were checked in an earlier run, e.g. a
+// shared library, without their source. An interface holds everything the checker needs from a class. The
+// records are preceded by an index so a reader can find a class without parsing the whole file:
+//
+//   cool-interface 2
+//   index <number of classes>
+//   <class name> <record offset> <record length>   (offsets are from the start of the first record)
+//   records
+//   class <name> <parent> <line> <filename>
+//   attr <name> <type> <line>
+//   method <name> <return type> <line> <number of formals> <formal name> <formal type> ...
+//   end
+//
+static const char* interfaceFileHeader = "cool-interface 2";
+
+InterfaceFile::~InterfaceFile()
 {
-    using namespace std;
+    if (m_mapping != nullptr) munmap(const_cast<char*>(m_mapping), m_size);
+}
 
-    // Just used to check for multiply defined children
-    map<string, Class_> allDefinedChildren;
+bool InterfaceFile::Open(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
 
-    for(int i = m_classes->first(); m_classes->more(i); i = m_classes->next(i))
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
     {
-        string parentName = m_classes->nth(i)->get_parent()->get_string();
-        string childName = m_classes->nth(i)->get_name()->get_string();
+        close(fd);
+        return false;
+    }
 
-        if (childName == SELF_TYPE->get_string())
+    m_size = fileStat.st_size;
+    void* mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return false;
+    m_mapping = static_cast<const char*>(mapping);
+
+    // Only the index is parsed here, it ends at the "records" line
+    const char* end = m_mapping + m_size;
+    const char* recordsLine = static_cast<const char*>(memmem(m_mapping, m_size, "\nrecords\n", 9));
+    if (recordsLine == nullptr) return false;
+
+    std::istringstream index(std::string(m_mapping, recordsLine));
+    std::string header, tag;
+    size_t numClasses = 0;
+    if (!std::getline(index, header) || header != interfaceFileHeader || !(index >> tag >> numClasses) || tag != "index")
+    {
+        return false;
+    }
+
+    m_records = recordsLine + 9;
+    for (size_t i = 0; i < numClasses; i++)
+    {
+        std::string className;
+        size_t offset = 0;
+        size_t length = 0;
+        if (!(index >> className >> offset >> length) || m_records + offset + length > end)
         {
-            semant_error(m_classes->nth(i));
-            error_stream << "Redefinition of basic class SELF_TYPE" << endl;
+            return false;
+        }
+        m_index[className] = { offset, length };
+    }
+
+    return true;
+}
+
+bool InterfaceFile::HasClass(const std::string& className) const
+{
+    return m_index.find(className) != m_index.end();
+}
+
+std::string InterfaceFile::GetClassRecord(const std::string& className) const
+{
+    auto found = m_index.find(className);
+    return found != m_index.end() ? std::string(m_records + found->second.first, found->second.second) : std::string();
+}
+
+// Names of the classes a class refers to in its signature, and with includeBodies in its expressions too
+static void CollectReferencedClasses(Class_ currentClass, bool includeBodies, std::vector<std::string>& classNames)
+{
+    classNames.push_back(currentClass->get_parent()->get_string());
+
+    std::vector<Expression> expressions;
+    Features features = currentClass->get_features();
+    for (int i = features->first(); features->more(i); i = features->next(i))
+    {
+        Feature feature = features->nth(i);
+        classNames.push_back(feature->get_type()->get_string());
+        if (feature->is_attr() == false)
+        {
+            Formals formals = static_cast<method_class*>(feature)->get_formals();
+            for(int i = formals->first(); formals->more(i); i = formals->next(i))
+            {
+                classNames.push_back(formals->nth(i)->get_type()->get_string());
+            }
+        }
+
+        if (includeBodies) CollectExpressions(feature->get_expression(), expressions);
+    }
+
+    for (Expression expression : expressions)
+    {
+        switch(expression->get_expr_type())
+        {
+            case ExpressionType::New:
+                classNames.push_back(static_cast<new__class*>(expression)->get_type_name()->get_string());
+                break;
+            case ExpressionType::StaticDispatch:
+                classNames.push_back(expression->get_dispatch_subclass_type()->get_string());
+                break;
+            case ExpressionType::Let:
+                classNames.push_back(static_cast<let_class*>(expression)->get_let_type_decl()->get_string());
+                break;
+            case ExpressionType::TypeCase:
+            {
+                Cases cases = static_cast<typcase_class*>(expression)->get_cases();
+                for(int i = cases->first(); cases->more(i); i = cases->next(i))
+                {
+                    classNames.push_back(static_cast<branch_class*>(cases->nth(i))->get_type()->get_string());
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+// Interface classes are loaded on first reference: starting from the names the program's classes mention, a class
+// found in an interface index is parsed and installed, and the names its own signature mentions (its parent
+// chain, attribute and method types) are followed in turn. Classes nobody refers to are never parsed.
+void ClassTable::install_interface_classes()
+{
+    // Imported classes are built as new tree nodes with interned names
+    std::lock_guard<std::mutex> lock(ast_mutex);
+
+    for (const char* path : semant_interface_files)
+    {
+        std::unique_ptr<InterfaceFile> interfaceFile = std::make_unique<InterfaceFile>();
+        if (interfaceFile->Open(path) == false)
+        {
+            semant_error(DiagnosticCode::InterfaceRead) << "Could not read class interface file " << path << endl;
+            continue;
+        }
+        m_interfaceFiles.push_back({ path, std::move(interfaceFile) });
+    }
+
+    if (m_interfaceFiles.empty()) return;
+
+    // The program's own class names are followed too, so a class defined both here and in an interface is still
+    // reported as multiply defined
+    std::vector<std::string> pending;
+    for(int i = m_classes->first(); m_classes->more(i); i = m_classes->next(i))
+    {
+        pending.push_back(m_classes->nth(i)->get_name()->get_string());
+        CollectReferencedClasses(m_classes->nth(i), true, pending);
+    }
+
+    std::set<std::string> visited;
+    int numIndexed = 0;
+    for (const auto& interfaceFile : m_interfaceFiles) numIndexed += interfaceFile.second->GetNumClasses();
+
+    // First in first out so classes are installed in the order they are first referenced
+    for (size_t next = 0; next < pending.size(); next++)
+    {
+        std::string className = pending[next];
+        if (visited.insert(className).second == false) continue;
+
+        for (const auto& interfaceFile : m_interfaceFiles)
+        {
+            if (interfaceFile.second->HasClass(className) == false) continue;
+
+            Class_ interfaceClass = ParseInterfaceClass(interfaceFile.second->GetClassRecord(className));
+            if (interfaceClass == nullptr)
+            {
+                semant_error(DiagnosticCode::InterfaceRead) << "Could not read class " << className << " from class interface file " << interfaceFile.first << endl;
+                continue;
+            }
+
+            m_classes = append_Classes(m_classes, single_Classes(interfaceClass));
+            m_interfaceClasses.insert(interfaceClass);
+            CollectReferencedClasses(interfaceClass, false, pending);
+        }
+    }
+
+    if (semant_debug)
+    {
+        cerr << "Loaded " << m_interfaceClasses.size() << " of " << numIndexed << " interface classes" << endl;
+    }
+}
+
+Class_ ClassTable::ParseInterfaceClass(const std::string& record)
+{
+    // idtable lookups are linear, intern each name once
+    auto intern = [this](const std::string& name) {
+        Symbol& symbol = m_interfaceSymbols[name];
+        if (symbol == nullptr) symbol = idtable.add_string(const_cast<char*>(name.c_str()));
+        return symbol;
+    };
+
+    std::istringstream stream(record);
+    std::string tag, className, parentName, filename;
+    int classLine = 0;
+    if (!(stream >> tag >> className >> parentName >> classLine) || tag != "class" || !std::getline(stream >> std::ws, filename))
+    {
+        return nullptr;
+    }
+
+    // The tree package stamps nodes with the current line, use the lines recorded at export
+    int savedLineNumber = node_lineno;
+
+    Features features = nil_Features();
+    while (stream >> tag && tag != "end")
+    {
+        std::string name, type;
+        int featureLine = 0;
+        if (!(stream >> name >> type >> featureLine) || (tag != "attr" && tag != "method"))
+        {
+            node_lineno = savedLineNumber;
+            return nullptr;
+        }
+
+        node_lineno = featureLine;
+        if (tag == "attr")
+        {
+            features = append_Features(features, single_Features(attr(intern(name), intern(type), no_expr())));
+            continue;
+        }
+
+        int numFormals = 0;
+        stream >> numFormals;
+
+        Formals formals = nil_Formals();
+        for (int i = 0; i < numFormals; i++)
+        {
+            std::string formalName, formalType;
+            stream >> formalName >> formalType;
+            formals = append_Formals(formals, single_Formals(formal(intern(formalName), intern(formalType))));
+        }
+        features = append_Features(features, single_Features(method(intern(name), formals, intern(type), no_expr())));
+    }
+
+    node_lineno = classLine;
+    Class_ interfaceClass = tag == "end" && stream ? class_(intern(className), intern(parentName), features, stringtable.add_string(const_cast<char*>(filename.c_str()))) : nullptr;
+    node_lineno = savedLineNumber;
+    return interfaceClass;
+}
+
+// Write the interface of every class this program defines. Basic classes, classes that were themselves imported
+// and Main are left out, so programs can import several interfaces next to each other and define their own Main.
+bool ClassTable::ExportInterface(const char* path)
+{
+    std::ostringstream records;
+    std::vector<std::pair<std::string, std::pair<size_t, size_t>>> index;
+
+    for(int i = m_classes->first(); m_classes->more(i); i = m_classes->next(i))
+    {
+        Class_ currentClass = m_classes->nth(i);
+        if (currentClass->get_filename() == m_basicClassFilename || m_interfaceClasses.count(currentClass) > 0 || currentClass->get_name() == Main)
+        {
+            continue;
+        }
+
+        size_t offset = records.tellp();
+        records << "class " << currentClass->get_name() << " " << currentClass->get_parent() << " "
+                << currentClass->get_line_number() << " " << currentClass->get_filename() << "\n";
+
+        Features features = currentClass->get_features();
+        for (int i = features->first(); features->more(i); i = features->next(i))
+        {
+            Feature feature = features->nth(i);
+            records << (feature->is_attr() ? "attr " : "method ") << feature->get_name() << " " << feature->get_type() << " " << feature->get_line_number();
+            if (feature->is_attr() == false)
+            {
+                Formals formals = static_cast<method_class*>(feature)->get_formals();
+                records << " " << formals->len();
+                for(int i = formals->first(); formals->more(i); i = formals->next(i))
+                {
+                    records << " " << formals->nth(i)->get_name() << " " << formals->nth(i)->get_type();
+                }
+            }
+            records << "\n";
+        }
+        records << "end\n";
+
+        index.push_back({ currentClass->get_name()->get_string(), { offset, static_cast<size_t>(records.tellp()) - offset } });
+    }
+
+    std::ofstream stream(path, std::ios::trunc);
+    stream << interfaceFileHeader << "\n" << "index " << index.size() << "\n";
+    for (const auto& entry : index)
+    {
+        stream << entry.first << " " << entry.second.first << " " << entry.second.second << "\n";
+    }
+    stream << "records\n" << records.str();
+
+    stream.close();
+    if (!stream)
+    {
+        semant_error(DiagnosticCode::InterfaceWrite) << "Could not write class interface file " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+bool ClassTable::ValidateInheritance()
+{
+    using namespace std;
+
+    // Just used to check for multiply defined children
+    map<string, Class_> allDefinedChildren;
+
+    for(int i = m_classes->first(); m_classes->more(i); i = m_classes->next(i))
+    {
+        string parentName = m_classes->nth(i)->get_parent()->get_string();
+        string childName = m_classes->nth(i)->get_name()->get_string();
+
+        if (childName == SELF_TYPE->get_string())
+        {
+            semant_error(m_classes->nth(i), DiagnosticCode::SelfTypeRedefined) << "Redefinition of basic class SELF_TYPE" << endl;
             continue;
         }
 
         if (parentName == Int->get_string() || parentName == Bool->get_string() || parentName == Str->get_string())
         {
             // class inherits from a basic type
-            semant_error(m_classes->nth(i));
-            error_stream << "Class " << childName << " inherits from either Int, Bool, or String. This is illegal." << endl;
+            semant_error(m_classes->nth(i), DiagnosticCode::InheritsBasicClass) << "Class " << childName << " inherits from either Int, Bool, or String. This is illegal." << endl;
             continue;
         }
 
@@ -322,8 +1260,7 @@ bool ClassTable::ValidateInheritance()
             }
 
             // class is defined multiple times
-            semant_error(errorClass);
-            error_stream << "Class " << childName << " multiply defined" << endl;
+            semant_error(errorClass, DiagnosticCode::ClassRedefined) << "Class " << childName << " multiply defined" << endl;
             continue;
         }
         allDefinedChildren.insert({childName, m_classes->nth(i)});
@@ -331,8 +1268,7 @@ bool ClassTable::ValidateInheritance()
         if (parentName == childName)
         {
             // class inheritis from itself
-            semant_error(m_classes->nth(i));
-            error_stream << "Class " << childName << " inherits from itself" << endl;
+            semant_error(m_classes->nth(i), DiagnosticCode::InheritanceCycle) << "Class " << childName << " inherits from itself" << endl;
             continue;
         }
 
@@ -355,8 +1291,7 @@ bool ClassTable::ValidateInheritance()
             bool successfulInsertion = m_inheritanceNodeMap[parentName]->AddChild(m_inheritanceNodeMap[childName].get(), error_msg);
             if (successfulInsertion == false)
             {
-                semant_error(m_classes->nth(i));
-                error_stream << error_msg << endl;
+                semant_error(m_classes->nth(i), DiagnosticCode::InheritanceCycle) << error_msg << endl;
                 break;
             };
         }
@@ -370,8 +1305,7 @@ bool ClassTable::ValidateInheritance()
             bool successfulInsertion = m_inheritanceNodeMap[parentName]->AddChild(m_inheritanceNodeMap[childName].get(), error_msg);
             if (successfulInsertion == false)
             {
-                semant_error(m_classes->nth(i));
-                error_stream << error_msg << endl;
+                semant_error(m_classes->nth(i), DiagnosticCode::InheritanceCycle) << error_msg << endl;
                 break;
             };
         }
@@ -393,23 +1327,21 @@ bool ClassTable::ValidateInheritance()
                 if (node->GetName() == m_classes->nth(i)->get_parent()->get_string())
                 {
                     found = true;
-                    semant_error(m_classes->nth(i));
-                    error_stream << "parent class of " << m_classes->nth(i)->get_name() << " is not defined" << endl;
+                    semant_error(m_classes->nth(i), DiagnosticCode::UndefinedParent) << "parent class of " << m_classes->nth(i)->get_name() << " is not defined" << endl;
                     break;
                 }
             }
             if (found == false)
             {
-                error_stream << "Programmer error! some assumption is wrong" << endl;
+                semant_error(DiagnosticCode::Internal) << "Programmer error! some assumption is wrong" << endl;
             }
         }
     }
 
-    // Main must exist
-    if (m_inheritanceNodeMap.find("Main") == m_inheritanceNodeMap.end())
+    // Main must exist, unless the classes are only being exported for other programs to use
+    if (semant_export_file == nullptr && m_inheritanceNodeMap.find("Main") == m_inheritanceNodeMap.end())
     {
-        semant_error();
-        error_stream << "Class Main is not defined." << endl;
+        semant_error(DiagnosticCode::MainUndefined) << "Class Main is not defined." << endl;
     }
 
     if (semant_debug)
@@ -434,25 +1366,94 @@ bool ClassTable::ValidateInheritance()
     return semant_errors == 0;
 }
 
+// The -M limit while features are being checked. Holds every distinct diagnostic found so far in the order
+// FlushDiagnostics prints them, so it can tell when the limit is reached by diagnostics that come before a place.
+// Adding takes a lock, but the workers ask before every feature, so the place of the diagnostic that reaches the
+// limit is kept in an atomic and asking is a single load.
+class DiagnosticLimit
+{
+public:
+    DiagnosticLimit(const std::map<std::string, int>& fileOrder, int limit) : m_fileOrder(fileOrder), m_limit(limit) {}
+
+    void Add(const std::vector<Diagnostic>& diagnostics)
+    {
+        if (diagnostics.empty()) return;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const Diagnostic& diagnostic : diagnostics)
+        {
+            // interface files aren't in the order, their diagnostics are printed after all the others
+            auto file = m_fileOrder.find(diagnostic.m_filename);
+            int fileIndex = file != m_fileOrder.end() ? file->second : std::numeric_limits<int>::max();
+            m_diagnostics.insert(std::make_tuple(fileIndex, diagnostic.m_line, diagnostic.m_filename, diagnostic.m_code, diagnostic.m_message));
+        }
+
+        if (static_cast<int>(m_diagnostics.size()) >= m_limit)
+        {
+            auto last = std::next(m_diagnostics.begin(), m_limit - 1);
+            m_limitPlace.store(Place(std::get<0>(*last), std::get<1>(*last)), std::memory_order_relaxed);
+        }
+    }
+
+    // Whether at least the limit of distinct diagnostics are printed before anything at place, see Place
+    bool ReachedBefore(int64_t place) const
+    {
+        return m_limitPlace.load(std::memory_order_relaxed) < place;
+    }
+
+    // File and line in one number that orders like the pair
+    static int64_t Place(int fileIndex, int line)
+    {
+        return (static_cast<int64_t>(fileIndex) << 32) | static_cast<uint32_t>(line);
+    }
+
+private:
+    const std::map<std::string, int>& m_fileOrder;
+    int m_limit;
+    std::mutex m_mutex;
+    std::set<std::tuple<int, int, std::string, DiagnosticCode, std::string>> m_diagnostics;
+    std::atomic<int64_t> m_limitPlace{ std::numeric_limits<int64_t>::max() }; // until the limit is reached
+};
+
+// The smallest line anything in the feature is on, no diagnostic about the feature can be on an earlier one
+static int FirstLine(Feature feature)
+{
+    int line = feature->get_line_number();
+    std::vector<Expression> expressions;
+    CollectExpressions(feature->get_expression(), expressions);
+    for (Expression expression : expressions) line = std::min(line, expression->get_line_number());
+    if (!feature->is_attr())
+    {
+        Formals formals = static_cast<method_class*>(feature)->get_formals();
+        for (int i = formals->first(); formals->more(i); i = formals->next(i)) line = std::min(line, formals->nth(i)->get_line_number());
+    }
+    return line;
+}
+
 void ClassTable::CheckTypes()
 {
-    TypeEnvironment typeEnvironment;
+    SymbolEnvironment globalSymbols(&m_symbolArena);
+    globalSymbols.enterscope();
 
     // ***** CLASS GATHER PASS ***** //
     // Gather all declared classes in the symbol table
+    PhaseTimer classGatherTimer(SemantPhase::ClassGather);
     for(int i = m_classes->first(); m_classes->more(i); i = m_classes->next(i))
     {
         Class_ currentClass = m_classes->nth(i);
 
         std::string className = currentClass->get_name()->get_string();
-        typeEnvironment.m_symbols.addid(className, currentClass->get_name());
+        globalSymbols.addid(className, NewIdentifier(currentClass->get_name(), Binding()));
 
         // populate the class map for use later
         m_classMap[className] = currentClass;
     }
+    classGatherTimer.AddItems(m_classMap.size());
+    classGatherTimer.Stop();
 
     // ***** METHOD GATHER PASS ***** //
     // Now gather all methods and their formals in the symbol table
+    PhaseTimer methodGatherTimer(SemantPhase::MethodGather);
     bool mainDefinedInMain = false;
     for(int i = m_classes->first(); m_classes->more(i); i = m_classes->next(i))
     {
@@ -466,9 +1467,9 @@ void ClassTable::CheckTypes()
             method_class* methodObject = static_cast<method_class*>(feature);
             MethodKey key = MethodKey(currentClass, methodObject);
             // first check to make sure the method has not been previously defined
-            if (typeEnvironment.m_methodMap.find(key) != typeEnvironment.m_methodMap.end()) {
-                semant_error(currentClass->get_filename(), methodObject);
-                error_stream << "Method defined twice in the same class." << endl;
+            count_event(HotCounter::MethodMapLookups);
+            if (m_methodMap.find(key) != m_methodMap.end()) {
+                semant_error(currentClass->get_filename(), methodObject, DiagnosticCode::MethodRedefined) << "Method defined twice in the same class." << endl;
                 continue;
             }
 
@@ -480,15 +1481,13 @@ void ClassTable::CheckTypes()
                 Formal formal = formals->nth(i);
                 if (strcmp(formal->get_name()->get_string(), self->get_string()) == 0)
                 {
-                    semant_error(currentClass->get_filename(), formal);
-                    error_stream << "formal parameter cannot be named self" << endl;
+                    semant_error(currentClass->get_filename(), formal, DiagnosticCode::FormalNamedSelf) << "formal parameter cannot be named self" << endl;
                     continue;
                 }
 
                 if (formal->get_type() == SELF_TYPE)
                 {
-                    semant_error(currentClass->get_filename(), formal);
-                    error_stream << "formal parameter type cannot be SELF_TYPE" << endl;
+                    semant_error(currentClass->get_filename(), formal, DiagnosticCode::FormalSelfType) << "formal parameter type cannot be SELF_TYPE" << endl;
                     continue;
                 }
 
@@ -496,8 +1495,7 @@ void ClassTable::CheckTypes()
                 if (previouslyDefined)
                 {
                     // Formal with same name defined twice - no good
-                    semant_error(currentClass->get_filename(), formal);
-                    error_stream << "Formal parameter defined twice in the same method" << endl;
+                    semant_error(currentClass->get_filename(), formal, DiagnosticCode::FormalRedefined) << "Formal parameter defined twice in the same method" << endl;
                     continue;
                 }
 
@@ -512,21 +1510,25 @@ void ClassTable::CheckTypes()
                 mainDefinedInMain = true;
             }
 
-            typeEnvironment.m_methodMap[key] = MethodInfo(methodObject);
+            count_event(HotCounter::MethodMapLookups);
+            m_methodMap[key] = MethodInfo(methodObject);
         }
     }
+    methodGatherTimer.AddItems(m_methodMap.size());
+    methodGatherTimer.Stop();
 
-    if (mainDefinedInMain == false)
+    if (mainDefinedInMain == false && semant_export_file == nullptr)
     {
-        semant_error(m_classMap["Main"]);
-        error_stream << "main() method that takes no params must be decalred in Main class" << endl;
+        semant_error(m_classMap["Main"], DiagnosticCode::MainMethodUndefined) << "main() method that takes no params must be decalred in Main class" << endl;
     }
 
     // ***** METHOD INHERITANCE CHECK PASS ***** //
     // Now check to make sure that methods defined in child classes conform to the appropiate signature
+    PhaseTimer overrideTimer(SemantPhase::OverrideCheck);
     for(int i = m_classes->first(); m_classes->more(i); i = m_classes->next(i))
     {
         Class_ currentClass = m_classes->nth(i);
+        if (m_interfaceClasses.count(currentClass) > 0) continue; // checked when the interface was exported
 
         //todo: This is really unoptimized, we are checking a lot of classes that we don't need to check
         // for example if we have the inheritance relation A -> B -> C -> D and we first check D then
@@ -543,18 +1545,20 @@ void ClassTable::CheckTypes()
             if (feature->is_attr()) continue; // we don't care about attributes for this pass
 
             method_class* methodObject = static_cast<method_class*>(feature);
+            overrideTimer.AddItems(1);
             const InheritanceNode* parent = m_inheritanceNodeMap[className].get()->GetParent();
             MethodKey childKey = MethodKey(className, methodObject->get_name()->get_string());
             while (parent != nullptr)
             {
                 MethodKey parentKey = MethodKey(parent->GetName(), methodObject->get_name()->get_string());
-                if (typeEnvironment.m_methodMap.find(parentKey) != typeEnvironment.m_methodMap.end())
+                count_event(HotCounter::MethodMapLookups);
+                if (m_methodMap.find(parentKey) != m_methodMap.end())
                 {
                     // We have found a redefinition in a parent class, need to check to make sure that the number and types of formals are the same
-                    if (typeEnvironment.m_methodMap[parentKey] != typeEnvironment.m_methodMap[childKey])
+                    count_event(HotCounter::MethodMapLookups, 2);
+                    if (m_methodMap[parentKey] != m_methodMap[childKey])
                     {
-                        semant_error(currentClass->get_filename(), methodObject);
-                        error_stream << "Method redefined in " << className << " does not match parent class method signature" << endl;
+                        semant_error(currentClass->get_filename(), methodObject, DiagnosticCode::OverrideMismatch) << "Method redefined in " << className << " does not match parent class method signature" << endl;
                         break;
                     }
                 }
@@ -562,214 +1566,590 @@ void ClassTable::CheckTypes()
             }
         }
     }
-
-    // ***** ATTRIBUTE GATHER & FEATURE TYPE CHECK PASS ***** //
+    overrideTimer.Stop();
+
+    // ***** ATTRIBUTE GATHER PASS ***** //
+    // Build every class's frozen attribute environment up front so that the checking pass below only reads shared state
+    PhaseTimer attributeGatherTimer(SemantPhase::AttributeGather);
+    BuildAttributeEnvironments(globalSymbols);
+    attributeGatherTimer.AddItems(m_attributeEnvironments.size());
+    attributeGatherTimer.Stop();
+
+    // The gather passes always run to the end, an error they find late in one pass can come before one found early
+    // in another once the errors are sorted. The -M limit only lets the feature checks below be skipped.
+
+    // Covers loading and saving the incremental state as well as the checking itself
+    PhaseTimer featureTimer(SemantPhase::FeatureCheck);
+
+    // In incremental mode features whose body and dependencies are unchanged since the last run reuse that run's result
+    bool incremental = semant_incremental_file != nullptr || m_incrementalState != nullptr;
+    bool recordDependencies = incremental || semant_dependency_file != nullptr || semant_affected_class != nullptr;
+    IncrementalState loadedState;
+    if (incremental)
+    {
+        ComputeClassSignatures();
+        if (m_incrementalState == nullptr) loadedState.Load(semant_incremental_file);
+    }
+    const IncrementalState& previousState = m_incrementalState != nullptr ? *m_incrementalState : loadedState;
+
+    // ***** FEATURE TYPE CHECK PASS ***** //
+    // Every method body and attribute initializer is a separate task. A worker checks its tasks in its own
+    // scratch TypeEnvironment and hands the diagnostics for each task back in a separate buffer, the buffers
+    // are flushed in program order so the output is the same no matter how many workers run.
+    std::vector<std::pair<Class_, Feature>> tasks;
+    std::vector<Class_> checkedClasses;
+    std::vector<int> taskClasses; // index into checkedClasses of each task's class
+    std::map<std::string, int> fileOrder = DiagnosticFileOrder();
+    std::vector<int64_t> taskPlaces; // with -M, the first place a diagnostic about each task's feature can be at
     for(int i = m_classes->first(); m_classes->more(i); i = m_classes->next(i))
     {
         Class_ currentClass = m_classes->nth(i);
-        std::string className = currentClass->get_name()->get_string();
-
-        typeEnvironment.EnterScope();
-        typeEnvironment.m_currentClass = currentClass;
+        if (currentClass->get_filename() == m_basicClassFilename || m_interfaceClasses.count(currentClass) > 0)
+        {
+            continue; // basic and interface classes have no bodies to check, and basic classes are shared
+        }
 
-        // For each class hierarchy loop through all the parent classes and add their attributes to the symbol table
-        //  while checking to see if they are defined twice
-        const InheritanceNode* parentClassNode = m_inheritanceNodeMap[className].get();
-        while (parentClassNode != nullptr && parentClassNode->GetName() !=  No_class->get_string()) {
-            Class_ parentClass = m_classMap[parentClassNode->GetName()];
-            if (parentClass == nullptr) {
-                abort(); // Just for debug, this should never happen
+        Features features = currentClass->get_features();
+        for (int i = features->first(); features->more(i); i = features->next(i))
+        {
+            tasks.push_back({ currentClass, features->nth(i) });
+            taskClasses.push_back(checkedClasses.size());
+            if (semant_max_errors > 0)
+            {
+                int fileIndex = fileOrder.at(currentClass->get_filename()->get_string());
+                taskPlaces.push_back(DiagnosticLimit::Place(fileIndex, FirstLine(features->nth(i))));
             }
+        }
+        checkedClasses.push_back(currentClass);
+    }
 
-            // Atrribute gather and dedupe
-            Features features = parentClass->get_features();
-            for (int i = features->first(); features->more(i); i = features->next(i))
+    // A class is handed to m_onClassChecked once its last feature is done and every class before it has been handed
+    // over, so the callback sees the classes in program order while later classes are still being checked
+    std::unique_ptr<std::atomic<int>[]> remainingFeatures(new std::atomic<int>[checkedClasses.size()]);
+    std::vector<bool> classDone(checkedClasses.size(), false);
+    size_t nextCheckedClass = 0;
+    std::mutex checkedClassMutex;
+    bool handingOver = false;         // a thread is calling m_onClassChecked, only one may at a time
+    int64_t handOverNanoseconds = 0;  // spent in m_onClassChecked, which times itself, for -R
+    for (size_t i = 0; i < checkedClasses.size(); i++) remainingFeatures[i] = 0;
+    for (int classIndex : taskClasses) remainingFeatures[classIndex]++;
+
+    // The callback writes output, so it is called without the lock held. A class that becomes ready while another
+    // thread is handing classes over is left to that thread, which looks again before it stops.
+    auto classChecked = [&](int classIndex) {
+        std::vector<Class_> ready;
+        {
+            std::lock_guard<std::mutex> lock(checkedClassMutex);
+            if (classIndex >= 0) classDone[classIndex] = true;
+            if (handingOver) return;
+            handingOver = true;
+        }
+        while (true)
+        {
             {
-                Feature feature = features->nth(i);
-                // Only gathering attributes here
-                if (feature->is_attr() == false) continue;
-
-                std::string featureName = feature->get_name()->get_string();
-
-                if (featureName == "self")
+                std::lock_guard<std::mutex> lock(checkedClassMutex);
+                while (nextCheckedClass < checkedClasses.size() && classDone[nextCheckedClass])
                 {
-                    // Attribute with same name defined twice - continue to next attribute
-                    semant_error(parentClass->get_filename(), feature);
-                    error_stream << "'self' cannot be the name of an attribute." << endl;
-                    continue;
+                    ready.push_back(checkedClasses[nextCheckedClass++]);
                 }
-
-                // First make sure that the attribute is not previously defined, note that we have already done this for methods previously
-                if (typeEnvironment.m_symbols.probe(featureName) != nullptr)
+                if (ready.empty())
                 {
-                    // Attribute with same name defined twice - continue to next attribute
-                    semant_error(parentClass->get_filename(), feature);
-                    error_stream << "Attribute redefined in the same class or class hierarchy." << endl;
-                    continue;
+                    handingOver = false;
+                    return;
                 }
+            }
 
-                // Attribute not previously defined so we can add it to the symbol table
-                typeEnvironment.m_symbols.addid(featureName, feature->get_type());
+            std::chrono::steady_clock::time_point handOverStart;
+            if (semant_phase_timing) handOverStart = std::chrono::steady_clock::now();
+            for (Class_ readyClass : ready) m_onClassChecked(readyClass);
+            if (semant_phase_timing)
+            {
+                handOverNanoseconds +=
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - handOverStart).count();
             }
+            ready.clear();
+        }
+    };
 
-            parentClassNode = parentClassNode->GetParent();
+    if (m_onClassChecked)
+    {
+        for (size_t i = 0; i < checkedClasses.size(); i++)
+        {
+            if (remainingFeatures[i] == 0) classDone[i] = true;
         }
+        classChecked(-1); // classes without features are done before anything is checked
+    }
 
-        // Now we have a complete list of attributes in our symbol table, continue to type checking
+    WorkStealingScheduler scheduler(semant_jobs);
+    std::vector<std::unique_ptr<TypeEnvironment>> workerEnvironments(scheduler.GetNumWorkers());
+    featureTimer.AddItems(tasks.size());
+    std::vector<std::vector<Diagnostic>> taskDiagnostics(tasks.size());
+    std::vector<FeatureResult> taskResults(incremental ? tasks.size() : 0);
+    std::vector<std::vector<std::string>> taskDependencies(recordDependencies ? tasks.size() : 0);
+    bool measureCosts = semant_cost_ranking > 0 || semant_cost_file != nullptr;
+    std::vector<CheckCost> taskCosts(measureCosts ? tasks.size() : 0);
+    std::atomic<int> reusedTasks(0);
+
+    // With -M a feature is skipped once the limit is reached by errors that are printed before any error in the
+    // feature could be. Which features are skipped depends on the order the workers take them up in, what is printed
+    // does not.
+    std::unique_ptr<DiagnosticLimit> errorLimit;
+    if (semant_max_errors > 0)
+    {
+        errorLimit = std::make_unique<DiagnosticLimit>(fileOrder, semant_max_errors);
+        errorLimit->Add(m_diagnostics.GetDiagnostics());
+    }
 
-        // Feature type checking
-        Features features = currentClass->get_features();
-        for (int i = features->first(); features->more(i); i = features->next(i))
-        {
-            Feature feature = features->nth(i);
-            std::string featureName = feature->get_name()->get_string();
+    auto checkTask = [&](int task, int worker) {
+        if (errorLimit != nullptr && errorLimit->ReachedBefore(taskPlaces[task])) return;
 
-            typeEnvironment.EnterScope(); // enter scope in case we are processing a method
+        if (workerEnvironments[worker] == nullptr)
+        {
+            workerEnvironments[worker] = std::make_unique<TypeEnvironment>();
+            workerEnvironments[worker]->m_recordDependencies = recordDependencies;
+        }
+        TypeEnvironment& typeEnvironment = *workerEnvironments[worker];
 
-            if (feature->is_attr() == false)
+        uint64_t fingerprint = 0;
+        if (incremental)
+        {
+            fingerprint = FeatureFingerprint(tasks[task].first, tasks[task].second);
+            const FeatureResult* previousResult = previousState.Find(
+                tasks[task].first->get_name()->get_string(), tasks[task].second->get_name()->get_string(), tasks[task].second->is_attr());
+            if (previousResult != nullptr && previousResult->m_fingerprint == fingerprint && DependenciesUnchanged(*previousResult))
             {
-                // For methods we want to add all the formals to the symbol table
-                Formals formals = dynamic_cast<method_class*>(feature)->get_formals();
-                for(int i = formals->first(); formals->more(i); i = formals->next(i))
+                ApplyFeatureResult(tasks[task].second, *previousResult);
+                taskResults[task] = *previousResult;
+                taskDiagnostics[task] = previousResult->m_diagnostics;
+                if (errorLimit != nullptr) errorLimit->Add(taskDiagnostics[task]);
+                for (const std::pair<std::string, uint64_t>& dependency : previousResult->m_dependencies)
                 {
-                    Formal formal = formals->nth(i);
-                    typeEnvironment.m_symbols.addid(formal->get_name()->get_string(), formal->get_type());
+                    taskDependencies[task].push_back(dependency.first);
                 }
+                reusedTasks++;
+                return;
             }
+        }
 
-            //Recursively type check the expression if it is not NoExpr class
-            Expression expression = feature->get_expression();
-            if (expression->get_expr_type() != ExpressionType::NoExpr)
-            {
-                Symbol expressionType = TypeCheckExpression(typeEnvironment, expression);
+        typeEnvironment.m_cost = CheckCost();
+        std::chrono::steady_clock::time_point checkStart;
+        if (measureCosts) checkStart = std::chrono::steady_clock::now();
 
-                // todo: really gross SELF_TYPE special cases... I should clean this up
-                Symbol featureType = feature->get_type();
-                if (feature->is_attr() == false && featureType == SELF_TYPE && expressionType != SELF_TYPE)
-                {
-                    semant_error(typeEnvironment.m_currentClass->get_filename(), feature);
-                    error_stream << "Methods with return type SELF_TYPE must return self" << endl;
-                }
-                else if (expressionType == nullptr || IsClassChildOfClassOrEqual(expressionType, featureType, typeEnvironment) == false)
-                {
-                    semant_error(typeEnvironment.m_currentClass->get_filename(), feature);
-                    std::string errorString = feature->is_attr() ? "Attribute initialization type mismatch" : "Method expression and return type mismatch";
-                    error_stream << errorString << endl;
-                }
-            }
+        CheckFeature(typeEnvironment, tasks[task].first, tasks[task].second);
 
-            typeEnvironment.ExitScope(); // exit method scope
+        if (measureCosts)
+        {
+            typeEnvironment.m_cost.m_nanoseconds =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - checkStart).count();
+            taskCosts[task] = typeEnvironment.m_cost;
         }
 
-        typeEnvironment.m_currentClass = nullptr;
-        typeEnvironment.ExitScope();
-    }
-}
+        if (incremental)
+        {
+            taskResults[task] = CaptureFeatureResult(typeEnvironment, tasks[task].first, tasks[task].second, fingerprint);
+        }
+        if (recordDependencies)
+        {
+            taskDependencies[task].assign(typeEnvironment.m_dependencies.begin(), typeEnvironment.m_dependencies.end());
+        }
+        taskDiagnostics[task] = typeEnvironment.m_diagnostics.GetDiagnostics();
+        if (errorLimit != nullptr) errorLimit->Add(taskDiagnostics[task]);
+        typeEnvironment.m_diagnostics.Clear();
+    };
+
+    scheduler.Run(tasks.size(), [&](int task, int worker) {
+        AllocationScope allocationScope(AllocationSubsystem::TypeEnvironment);
+        checkTask(task, worker);
+        if (m_onClassChecked && --remainingFeatures[taskClasses[task]] == 0)
+        {
+            classChecked(taskClasses[task]);
+        }
+    });
+    if (semant_phase_timing) record_scheduler_stats("feature check", scheduler);
+    featureTimer.Exclude(handOverNanoseconds); // already counted as writing the typed AST
 
-bool ClassTable::IsClassChildOfClassOrEqual(Symbol childClass, Symbol potentialParentClass, const TypeEnvironment& typeEnvironment)
-{
-    if (childClass == SELF_TYPE && potentialParentClass == SELF_TYPE)
+    for (const std::vector<Diagnostic>& diagnostics : taskDiagnostics)
     {
-        // SELF_TYPE will always be from the same class so this is always true
-        return true;
-    }
-
-    if (potentialParentClass == SELF_TYPE) {
-        // T <= SELF_TYPEc should always be false, see self type lecture
-        return false;
+        m_diagnostics.Append(diagnostics);
+        semant_errors += diagnostics.size();
     }
 
-    if (childClass == SELF_TYPE) {
-        // SELF_TYPEc <= T if C <= T
-        childClass = typeEnvironment.m_currentClass->get_name();
+    for (size_t task = 0; task < taskDependencies.size(); task++)
+    {
+        m_dependencyGraph.AddFeature(tasks[task].first, tasks[task].second, taskDependencies[task]);
     }
 
-    if (childClass == nullptr || potentialParentClass == nullptr) {
-        return false;
+    for (size_t task = 0; task < taskCosts.size(); task++)
+    {
+        // features that were reused, skipped for the error limit or have no expression were not checked
+        if (taskCosts[task].m_expressions > 0) record_check_cost(tasks[task].first, tasks[task].second, taskCosts[task]);
     }
 
-    InheritanceNode* childNode = m_inheritanceNodeMap[childClass->get_string()].get();
-    InheritanceNode* parentNode = m_inheritanceNodeMap[potentialParentClass->get_string()].get();
+    if (incremental)
+    {
+        // Only the features of this program are kept, results for bodies that were edited or removed are dropped
+        IncrementalState nextState;
+        for (const FeatureResult& result : taskResults)
+        {
+            if (result.m_fingerprint != 0) nextState.Add(result); // 0 if the error limit skipped the feature
+        }
 
-    if (childNode == nullptr || parentNode == nullptr) {
-        return false;
+        if (m_incrementalState != nullptr)
+        {
+            *m_incrementalState = std::move(nextState);
+        }
+        else if (nextState.Save(semant_incremental_file) == false)
+        {
+            cerr << "Could not write incremental state file " << semant_incremental_file << endl;
+        }
     }
 
-    return childNode->IsChildOfOrEqual(parentNode);
+    if (semant_debug)
+    {
+        cerr << "Type checked " << tasks.size() << " features with " << scheduler.GetNumWorkers() << " workers" << endl;
+        if (incremental)
+        {
+            cerr << "  reused " << reusedTasks << " results from "
+                 << (m_incrementalState != nullptr ? "the previous check" : semant_incremental_file) << endl;
+        }
+        const std::vector<WorkStealingScheduler::WorkerStats>& stats = scheduler.GetStats();
+        for (int worker = 0; worker < static_cast<int>(stats.size()); worker++)
+        {
+            cerr << "  worker " << worker << ": " << stats[worker].m_tasksRun << " tasks, " << stats[worker].m_steals
+                 << " steals, " << stats[worker].m_failedSteals << " failed steal attempts" << endl;
+        }
+    }
 }
 
-Symbol ClassTable::FirstCommonAncestor(Symbol first, Symbol second, const TypeEnvironment& typeEnvironment)
+void ClassTable::CheckFeature(TypeEnvironment& typeEnvironment, Class_ currentClass, Feature feature)
 {
-    if (first == SELF_TYPE && second == SELF_TYPE)
+    // Start from the class's frozen attribute environment instead of re-inserting every ancestor attribute
+    typeEnvironment.m_symbolArena.Rewind(); // nothing refers to the previous feature's scopes any more
+    typeEnvironment.m_symbols = SymbolEnvironment(m_attributeEnvironments.find(currentClass->get_name()->get_string())->second, &typeEnvironment.m_symbolArena);
+    typeEnvironment.m_currentClass = currentClass;
+    typeEnvironment.m_dependencies.clear();
+    RecordDependency(typeEnvironment, currentClass->get_name()); // attribute environment, formals and SELF_TYPE
+    RecordDependency(typeEnvironment, feature->get_type());
+
+    typeEnvironment.EnterScope(); // enter scope in case we are processing a method
+    typeEnvironment.m_identifiersUsed = 0; // nothing refers to the previous feature's identifiers any more
+    typeEnvironment.m_nextLocalSlot = 0;
+    typeEnvironment.m_maxLocalSlots = 0;
+
+    if (feature->is_attr() == false)
     {
-        return SELF_TYPE;
+        // For methods we want to add all the formals to the symbol table
+        Formals formals = static_cast<method_class*>(feature)->get_formals();
+        for(int i = formals->first(); formals->more(i); i = formals->next(i))
+        {
+            Formal formal = formals->nth(i);
+            RecordDependency(typeEnvironment, formal->get_type());
+            typeEnvironment.m_symbols.addid(formal->get_name()->get_string(), typeEnvironment.NewIdentifier(formal->get_type(), Binding{BindingKind::Formal, i}));
+        }
     }
 
-    if (first == SELF_TYPE)
+    //Recursively type check the expression if it is not NoExpr class
+    Expression expression = feature->get_expression();
+    if (expression->get_expr_type() != ExpressionType::NoExpr)
     {
-        first = typeEnvironment.m_currentClass->get_name();
-    }
-    else if (second == SELF_TYPE)
+        Symbol expressionType = TypeCheckExpression(typeEnvironment, expression);
+
+        // todo: really gross SELF_TYPE special cases... I should clean this up
+        Symbol featureType = feature->get_type();
+        if (feature->is_attr() == false && featureType == SELF_TYPE && expressionType != SELF_TYPE)
+        {
+            semant_error(typeEnvironment, feature, DiagnosticCode::SelfTypeReturn) << "Methods with return type SELF_TYPE must return self" << endl;
+        }
+        else if (expressionType == nullptr || IsClassChildOfClassOrEqual(expressionType, featureType, typeEnvironment) == false)
+        {
+            std::string errorString = feature->is_attr() ? "Attribute initialization type mismatch" : "Method expression and return type mismatch";
+            semant_error(typeEnvironment, feature, feature->is_attr() ? DiagnosticCode::AttributeInitType : DiagnosticCode::MethodReturnType) << errorString << endl;
+        }
+    }
+
+    feature->set_local_slots(typeEnvironment.m_maxLocalSlots);
+    typeEnvironment.ExitScope(); // exit method scope
+    typeEnvironment.m_currentClass = nullptr;
+}
+
+IdentifierInfo* ClassTable::NewIdentifier(Symbol type, Binding binding)
+{
+    m_identifiers.emplace_back(type, binding);
+    return &m_identifiers.back();
+}
+
+// Read only lookups for the checking pass, unlike operator[] these never insert so they are safe to call from several workers
+const InheritanceNode* ClassTable::FindInheritanceNode(const std::string& className) const
+{
+    auto found = m_inheritanceNodeMap.find(className);
+    return found != m_inheritanceNodeMap.end() ? found->second.get() : nullptr;
+}
+
+Class_ ClassTable::FindClass(const std::string& className) const
+{
+    auto found = m_classMap.find(className);
+    return found != m_classMap.end() ? found->second : nullptr;
+}
+
+void ClassTable::BuildAttributeEnvironments(const SymbolEnvironment& globalSymbols)
+{
+    // Every class is built after its ancestors: from each class in program order walk up to the first ancestor that
+    // is already built, then build the classes passed on the way from the top down. The walk is a loop, so a long
+    // inheritance chain doesn't take stack, and the attribute errors come in the same order as building each
+    // ancestor on first use would give.
+    std::vector<std::string> unbuilt;
+    for(int i = m_classes->first(); m_classes->more(i); i = m_classes->next(i))
+    {
+        std::string className = m_classes->nth(i)->get_name()->get_string();
+        while (m_attributeEnvironments.count(className) == 0)
+        {
+            unbuilt.push_back(className);
+            const InheritanceNode* parentNode = m_inheritanceNodeMap[className]->GetParent();
+            if (parentNode == nullptr || parentNode->GetName() == No_class->get_string()) break;
+            className = parentNode->GetName();
+        }
+
+        for (auto unbuiltClass = unbuilt.rbegin(); unbuiltClass != unbuilt.rend(); ++unbuiltClass)
+        {
+            BuildAttributeEnvironment(*unbuiltClass, globalSymbols);
+        }
+        unbuilt.clear();
+    }
+}
+
+void ClassTable::BuildAttributeEnvironment(const std::string& className, const SymbolEnvironment& globalSymbols)
+{
+    // A class's environment is its parent's environment plus one scope holding the attributes the class itself
+    // declares. The parent's is already built, see BuildAttributeEnvironments.
+    const InheritanceNode* parentNode = m_inheritanceNodeMap[className]->GetParent();
+    SymbolEnvironment environment = globalSymbols;
+    int attributeOffset = 0;
+    if (parentNode != nullptr && parentNode->GetName() != No_class->get_string())
+    {
+        environment = m_attributeEnvironments.at(parentNode->GetName());
+        attributeOffset = m_attributeCounts[parentNode->GetName()];
+    }
+    environment.enterscope();
+    count_event(HotCounter::ScopePushes);
+
+    Class_ currentClass = m_classMap[className];
+    if (currentClass == nullptr) {
+        abort(); // Just for debug, this should never happen
+    }
+
+    // Atrribute gather and dedupe
+    Features features = currentClass->get_features();
+    for (int i = features->first(); features->more(i); i = features->next(i))
+    {
+        Feature feature = features->nth(i);
+        // Only gathering attributes here
+        if (feature->is_attr() == false) continue;
+
+        std::string featureName = feature->get_name()->get_string();
+
+        if (featureName == "self")
+        {
+            semant_error(currentClass->get_filename(), feature, DiagnosticCode::AttributeNamedSelf) << "'self' cannot be the name of an attribute." << endl;
+            continue;
+        }
+
+        // First make sure that the attribute is not previously defined in this class or any ancestor, note that we have already done this for methods previously
+        count_event(HotCounter::SymbolLookups);
+        if (environment.lookup(featureName) != nullptr)
+        {
+            // Attribute with same name defined twice - continue to next attribute
+            semant_error(currentClass->get_filename(), feature, DiagnosticCode::AttributeRedefined) << "Attribute redefined in the same class or class hierarchy." << endl;
+            continue;
+        }
+
+        // Attribute not previously defined so we can add it to the symbol table
+        environment.addid(featureName, NewIdentifier(feature->get_type(), Binding{BindingKind::Attribute, attributeOffset++}));
+    }
+
+    m_attributeCounts[className] = attributeOffset;
+    m_attributeEnvironments.emplace(className, environment);
+}
+
+bool ClassTable::IsClassChildOfClassOrEqual(Symbol childClass, Symbol potentialParentClass, TypeEnvironment& typeEnvironment)
+{
+    typeEnvironment.m_cost.m_conformanceChecks++;
+    count_event(HotCounter::ConformanceChecks);
+
+    if (childClass == SELF_TYPE && potentialParentClass == SELF_TYPE)
+    {
+        // SELF_TYPE will always be from the same class so this is always true
+        return true;
+    }
+
+    if (potentialParentClass == SELF_TYPE) {
+        // T <= SELF_TYPEc should always be false, see self type lecture
+        return false;
+    }
+
+    if (childClass == SELF_TYPE) {
+        // SELF_TYPEc <= T if C <= T
+        childClass = typeEnvironment.m_currentClass->get_name();
+    }
+
+    if (childClass == nullptr || potentialParentClass == nullptr) {
+        return false;
+    }
+
+    RecordDependency(typeEnvironment, childClass);
+    RecordDependency(typeEnvironment, potentialParentClass);
+
+    const InheritanceNode* childNode = FindInheritanceNode(childClass->get_string());
+    const InheritanceNode* parentNode = FindInheritanceNode(potentialParentClass->get_string());
+    count_event(HotCounter::StringTemporaries, 2);
+
+    if (childNode == nullptr || parentNode == nullptr) {
+        return false;
+    }
+
+    return childNode->IsChildOfOrEqual(parentNode);
+}
+
+Symbol ClassTable::FirstCommonAncestor(Symbol first, Symbol second, TypeEnvironment& typeEnvironment)
+{
+    count_event(HotCounter::CommonAncestorCalls);
+
+    if (first == nullptr || second == nullptr)
+    {
+        return nullptr;
+    }
+
+    if (first == SELF_TYPE && second == SELF_TYPE)
+    {
+        return SELF_TYPE;
+    }
+
+    if (first == SELF_TYPE)
+    {
+        first = typeEnvironment.m_currentClass->get_name();
+    }
+    else if (second == SELF_TYPE)
     {
         second = typeEnvironment.m_currentClass->get_name();
     }
 
-    const InheritanceNode* thenTypeNode = m_inheritanceNodeMap[first->get_string()].get();
-    const InheritanceNode* elseTypeNode = m_inheritanceNodeMap[second->get_string()].get();
+    RecordDependency(typeEnvironment, first);
+    RecordDependency(typeEnvironment, second);
+
+    const InheritanceNode* thenTypeNode = FindInheritanceNode(first->get_string());
+    const InheritanceNode* elseTypeNode = FindInheritanceNode(second->get_string());
+    count_event(HotCounter::StringTemporaries, 2);
+    if (thenTypeNode == nullptr || elseTypeNode == nullptr)
+    {
+        return nullptr;
+    }
 
     const InheritanceNode* commonAncestor = thenTypeNode->FirstCommonAncestor(elseTypeNode);
 
-    return m_classMap[commonAncestor->GetName()]->get_name();
+    return FindClass(commonAncestor->GetName())->get_name();
+}
+
+Symbol ClassTable::TypeCheckExpression(TypeEnvironment& typeEnvironment, Expression rootExpression)
+{
+    // Post-order walk over an explicit stack so that deeply nested expressions are limited by the heap and not
+    // by the C++ stack. Each frame is resumed every time one of its children has been checked, ResumeCheck returns
+    // the next child to check or nullptr once the frame's own type is known.
+    std::vector<CheckFrame>& stack = typeEnvironment.m_checkStack;
+    size_t bottom = stack.size();
+    stack.push_back(CheckFrame(rootExpression));
+
+    Symbol rootType = nullptr;
+    while (stack.size() > bottom)
+    {
+        Expression child = ResumeCheck(typeEnvironment, stack.back());
+        if (child != nullptr)
+        {
+            stack.push_back(CheckFrame(child));
+            continue;
+        }
+
+        Expression expression = stack.back().m_expression;
+        Symbol expressionType = stack.back().m_type;
+        stack.pop_back();
+        typeEnvironment.m_cost.m_expressions++;
+        count_expression(expression->get_expr_type());
+
+        if (expressionType != nullptr)
+        {
+            expression->set_type(expressionType);
+        }
+
+        if (stack.size() > bottom)
+        {
+            stack.back().m_childType = expressionType;
+        }
+        else
+        {
+            rootType = expressionType;
+        }
+    }
+
+    return rootType;
 }
 
-Symbol ClassTable::TypeCheckExpression(TypeEnvironment& typeEnvironment,  Expression expression)
+Expression ClassTable::ResumeCheck(TypeEnvironment& typeEnvironment, CheckFrame& frame)
 {
-    Symbol expressionType = nullptr;
+    Expression expression = frame.m_expression;
+    int stage = frame.m_stage++;
+
     switch(expression->get_expr_type())
     {
         case ExpressionType::Assign:
         {
-            Symbol name = static_cast<assign_class*>(expression)->get_symbol_name();
-            Expression assignExpr = static_cast<assign_class*>(expression)->get_expr();
-            Symbol exprType = TypeCheckExpression(typeEnvironment, assignExpr);
+            assign_class* assignExpr = static_cast<assign_class*>(expression);
+            if (stage == 0) return assignExpr->get_expr();
+
+            Symbol exprType = frame.m_childType;
 
             // The assign expression is accepted as long as it assigning a subclass of the declared identifier type
-            Symbol parentType = typeEnvironment.m_symbols.lookup(name->get_string());
+            IdentifierInfo* identifierInfo = typeEnvironment.m_symbols.lookup(assignExpr->get_symbol_name()->get_string());
+            typeEnvironment.m_cost.m_symbolLookups++;
+            count_event(HotCounter::SymbolLookups);
+            count_event(HotCounter::StringTemporaries);
+            Symbol parentType = identifierInfo != nullptr ? identifierInfo->m_type : nullptr;
             if (IsClassChildOfClassOrEqual(exprType, parentType, typeEnvironment) == false)
             {
-                semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                error_stream << "Assignment expression has a static type that does not match the identifier, or the identifier type is unknown" << endl;
-                break;
+                semant_error(typeEnvironment, expression, DiagnosticCode::AssignType) << "Assignment expression has a static type that does not match the identifier, or the identifier type is unknown" << endl;
+                return nullptr;
             }
-            expressionType = exprType;
-            break;
+            assignExpr->set_binding(identifierInfo->m_binding);
+            frame.m_type = exprType;
+            return nullptr;
         }
         case ExpressionType::Block:
         {
+            // The block has the type of the last expression checked so far
             Expressions expressions = static_cast<block_class*>(expression)->get_body();
-            for(int i = expressions->first(); expressions->more(i); i = expressions->next(i))
-            {
-                Expression blockExpr = expressions->nth(i);
-                expressionType = TypeCheckExpression(typeEnvironment, blockExpr);
-            }
-            break;
+            frame.m_type = frame.m_childType;
+            return expressions->more(stage) ? expressions->nth(stage) : nullptr;
         }
         case ExpressionType::Conditional:
         {
             cond_class* conditional = static_cast<cond_class*>(expression);
-            Symbol predType = TypeCheckExpression(typeEnvironment, conditional->get_pred());
+            if (stage == 0) return conditional->get_pred();
 
-            if (predType->get_string() != Bool->get_string())
+            if (stage == 1)
             {
-                semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                error_stream << "Conditional statement predicate must be of static type Boolean" << endl;
-                break;
+                if (frame.m_childType != Bool)
+                {
+                    semant_error(typeEnvironment, expression, DiagnosticCode::ConditionalPredicate) << "Conditional statement predicate must be of static type Boolean" << endl;
+                    return nullptr;
+                }
+                return conditional->get_then();
             }
 
-            Symbol thenType = TypeCheckExpression(typeEnvironment, conditional->get_then());
-            Symbol elseType = TypeCheckExpression(typeEnvironment, conditional->get_else());
-            expressionType = FirstCommonAncestor(thenType, elseType, typeEnvironment);
-            break;
+            if (stage == 2)
+            {
+                frame.m_savedType = frame.m_childType; // then type
+                return conditional->get_else();
+            }
+
+            frame.m_type = FirstCommonAncestor(frame.m_savedType, frame.m_childType, typeEnvironment);
+            return nullptr;
         }
         case ExpressionType::Dispatch:
         case ExpressionType::StaticDispatch:
@@ -778,279 +2158,318 @@ Symbol ClassTable::TypeCheckExpression(TypeEnvironment& typeEnvironment,  Expres
             // <id>(<expr>,...,<expr>) aka self.<id>(<expr>,...,<expr>)
             // <expr>@<type>.id(<expr>,...,<expr>)
 
-            Symbol identifierExprType = TypeCheckExpression(typeEnvironment, expression->get_dispatch_id_expr());
-            bool isIdentifierTypeSelfType = identifierExprType == SELF_TYPE;
-            if (isIdentifierTypeSelfType) identifierExprType = typeEnvironment.m_currentClass->get_name();
-            Symbol subclassName = expression->get_dispatch_subclass_type();
-
-            bool isStaticDispatch = subclassName != nullptr;
-            if (isStaticDispatch && subclassName == SELF_TYPE)
-            {
-                semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                error_stream << "SELF_TYPE cannot be used in static dispatch expression" << endl;
-                return nullptr;
-            }
+            if (stage == 0) return expression->get_dispatch_id_expr();
 
-            // First check to make sure that the static type of the expr conforms to the subclass type we are dispatching too
-            if (isStaticDispatch && IsClassChildOfClassOrEqual(identifierExprType, subclassName, typeEnvironment) == false)
+            Expressions formalExpressions = expression->get_dispatch_param_expressions();
+            if (stage == 1)
             {
-                semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                error_stream << "The dispatch expression static type of " << identifierExprType->get_string() << " is not a subclass of " << subclassName->get_string() << endl;
-                return nullptr;
-            }
+                Symbol identifierExprType = frame.m_childType;
+                bool isIdentifierTypeSelfType = identifierExprType == SELF_TYPE;
+                if (isIdentifierTypeSelfType) identifierExprType = typeEnvironment.m_currentClass->get_name();
+                Symbol subclassName = expression->get_dispatch_subclass_type();
 
-            Symbol baseClassType = isStaticDispatch ? subclassName : identifierExprType;
+                bool isStaticDispatch = subclassName != nullptr;
+                if (isStaticDispatch && subclassName == SELF_TYPE)
+                {
+                    semant_error(typeEnvironment, expression, DiagnosticCode::StaticDispatchSelfType) << "SELF_TYPE cannot be used in static dispatch expression" << endl;
+                    return nullptr;
+                }
 
-            // Then check to make sure that a method with that name exists on the class or its parents
-            bool methodFound = false;
-            MethodInfo foundMethodInfo;
-            std::string methodName = expression->get_dispatch_method_name()->get_string();
-            while (baseClassType != nullptr)
-            {
-                MethodKey methodKey = MethodKey(baseClassType->get_string(), methodName);
-                if (typeEnvironment.m_methodMap.find(methodKey) != typeEnvironment.m_methodMap.end())
+                // First check to make sure that the static type of the expr conforms to the subclass type we are dispatching too
+                if (isStaticDispatch && IsClassChildOfClassOrEqual(identifierExprType, subclassName, typeEnvironment) == false)
                 {
-                    foundMethodInfo = typeEnvironment.m_methodMap[methodKey];
-                    methodFound = true;
-                    break;
+                    const char* identifierTypeName = identifierExprType != nullptr ? identifierExprType->get_string() : No_type->get_string();
+                    semant_error(typeEnvironment, expression, DiagnosticCode::StaticDispatchType) << "The dispatch expression static type of " << identifierTypeName << " is not a subclass of " << subclassName->get_string() << endl;
+                    return nullptr;
                 }
-                const InheritanceNode* parentNode = m_inheritanceNodeMap[baseClassType->get_string()]->GetParent();
-                std::string parentClassName = parentNode->GetName();
 
-                if (parentClassName == No_class->get_string()) break; // reached the top of the inheritance hierarchy
+                Symbol baseClassType = isStaticDispatch ? subclassName : identifierExprType;
+                RecordDependency(typeEnvironment, baseClassType);
 
-                baseClassType = m_classMap[parentClassName]->get_name();
-            }
+                // Then check to make sure that a method with that name exists on the class or its parents
+                std::string methodName = expression->get_dispatch_method_name()->get_string();
+                count_event(HotCounter::StringTemporaries);
+                while (baseClassType != nullptr)
+                {
+                    MethodKey methodKey = MethodKey(baseClassType->get_string(), methodName);
+                    auto foundMethod = m_methodMap.find(methodKey);
+                    typeEnvironment.m_cost.m_symbolLookups++;
+                    count_event(HotCounter::MethodMapLookups);
+                    if (foundMethod != m_methodMap.end())
+                    {
+                        frame.m_method = &foundMethod->second;
+                        break;
+                    }
+                    const InheritanceNode* baseClassNode = FindInheritanceNode(baseClassType->get_string());
+                    if (baseClassNode == nullptr) break; // dispatch on an undefined class
 
-            if (methodFound == false)
-            {
-                semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                error_stream << "Tried to call method that was not defined in the specified class hierarchy" << endl;
-                return nullptr;
-            }
+                    std::string parentClassName = baseClassNode->GetParent()->GetName();
+                    count_event(HotCounter::StringTemporaries, 2);
 
-            // Then gather all of the method formal types
-            Expressions formalExpressions = expression->get_dispatch_param_expressions();
-            for(int i = formalExpressions->first(); formalExpressions->more(i); i = formalExpressions->next(i))
+                    if (parentClassName == No_class->get_string()) break; // reached the top of the inheritance hierarchy
+
+                    baseClassType = FindClass(parentClassName)->get_name();
+                }
+
+                if (frame.m_method == nullptr)
+                {
+                    semant_error(typeEnvironment, expression, DiagnosticCode::UndefinedMethod) << "Tried to call method that was not defined in the specified class hierarchy" << endl;
+                    return nullptr;
+                }
+
+                frame.m_savedType = identifierExprType;
+                frame.m_isSelfTypeReceiver = isIdentifierTypeSelfType;
+            }
+            else
             {
+                // Check the actual that was just checked against the matching formal type
+                int i = stage - 2;
                 Expression formalExpression = formalExpressions->nth(i);
-                Symbol formalExpressionType = TypeCheckExpression(typeEnvironment, formalExpression);
+                Symbol formalExpressionType = frame.m_childType;
                 if (formalExpressionType == nullptr)
                 {
-                    semant_error(typeEnvironment.m_currentClass->get_filename(), formalExpression);
-                    error_stream << "Formal has unknown type in dispatch expression" << endl;
+                    semant_error(typeEnvironment, formalExpression, DiagnosticCode::DispatchArgumentType) << "Formal has unknown type in dispatch expression" << endl;
                     return nullptr;
                 }
-                
-                Symbol foundFormalExpressionType = foundMethodInfo.GetFormalTypes()[i];
-                if (IsClassChildOfClassOrEqual(formalExpressionType, foundFormalExpressionType, typeEnvironment) == false)
+
+                const std::vector<Symbol>& foundFormalTypes = frame.m_method->GetFormalTypes();
+                if (i >= static_cast<int>(foundFormalTypes.size()) || IsClassChildOfClassOrEqual(formalExpressionType, foundFormalTypes[i], typeEnvironment) == false)
                 {
-                    semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                    error_stream << "Method signature in dispatch expression does not match declaration" << endl;
+                    semant_error(typeEnvironment, expression, DiagnosticCode::DispatchSignature) << "Method signature in dispatch expression does not match declaration" << endl;
                 }
             }
 
-            if (foundMethodInfo.GetReturnType() == SELF_TYPE)
+            // Then check the next actual, once they are all checked the dispatch has the method's return type
+            int nextFormal = stage - 1;
+            if (formalExpressions->more(nextFormal)) return formalExpressions->nth(nextFormal);
+
+            if (frame.m_method->GetReturnType() == SELF_TYPE)
             {
-                expressionType = isIdentifierTypeSelfType ? SELF_TYPE : identifierExprType;
+                frame.m_type = frame.m_isSelfTypeReceiver ? SELF_TYPE : frame.m_savedType;
             }
             else
             {
-                expressionType = foundMethodInfo.GetReturnType();
+                frame.m_type = frame.m_method->GetReturnType();
             }
-            break;
+            return nullptr;
         }
         case ExpressionType::New:
         {
-            expressionType = static_cast<new__class*>(expression)->get_type_name();
-            break;
+            frame.m_type = static_cast<new__class*>(expression)->get_type_name();
+            RecordDependency(typeEnvironment, frame.m_type);
+            return nullptr;
         }
         case ExpressionType::Let:
         {
             let_class* letExpr = static_cast<let_class*>(expression);
-
             Symbol letId = letExpr->get_let_id();
-            if (strcmp(letId->get_string(), self->get_string()) == 0)
-            {
-                semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                error_stream << "let method identier cannot be named self" << endl;
-            }
-
             Symbol letTypeDecl = letExpr->get_let_type_decl();
             Expression letInit = letExpr->get_let_init();
-            Expression letBody = letExpr->get_let_body();	
+            bool hasInit = letInit->get_expr_type() != ExpressionType::NoExpr;
+
+            if (stage == 0)
+            {
+                if (strcmp(letId->get_string(), self->get_string()) == 0)
+                {
+                    semant_error(typeEnvironment, expression, DiagnosticCode::BindSelf) << "let method identier cannot be named self" << endl;
+                }
+
+                if (hasInit) return letInit;
 
-            if (letInit->get_expr_type() != ExpressionType::NoExpr)
+                // Nothing to initialize, move straight on to the body
+                stage = frame.m_stage++;
+            }
+
+            if (stage == 1)
             {
-                Symbol initType = TypeCheckExpression(typeEnvironment, letInit);
-                if (IsClassChildOfClassOrEqual(initType, letTypeDecl, typeEnvironment) == false)
+                if (hasInit && IsClassChildOfClassOrEqual(frame.m_childType, letTypeDecl, typeEnvironment) == false)
                 {
-                    semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                    error_stream << "let-init method static type does not match type declaration" << endl;
+                    semant_error(typeEnvironment, expression, DiagnosticCode::LetInitType) << "let-init method static type does not match type declaration" << endl;
                 }
+
+                RecordDependency(typeEnvironment, letTypeDecl);
+                typeEnvironment.EnterScope(); // let scope
+                typeEnvironment.m_symbols.addid(letId->get_string(), typeEnvironment.NewIdentifier(letTypeDecl, Binding{BindingKind::Local, typeEnvironment.AllocateLocalSlot()}));
+                return letExpr->get_let_body();
             }
-            
-            typeEnvironment.EnterScope(); // let scope
-            
-            typeEnvironment.m_symbols.addid(letId->get_string(), letTypeDecl);
-            expressionType = TypeCheckExpression(typeEnvironment, letBody);
 
+            frame.m_type = frame.m_childType;
+            typeEnvironment.FreeLocalSlot();
             typeEnvironment.ExitScope();
-            break;
+            return nullptr;
         }
         case ExpressionType::TypeCase:
         {
             typcase_class* typecaseExpr = static_cast<typcase_class*>(expression);
-            Cases cases = typecaseExpr->get_cases();
-            Expression caseExpr = typecaseExpr->get_case_expr();
+            if (stage == 0) return typecaseExpr->get_case_expr();
 
-            Symbol caseExprType = TypeCheckExpression(typeEnvironment, caseExpr); 
-            std::set<Symbol> branchTypes;
-            for(int i = cases->first(); cases->more(i); i = cases->next(i))
+            if (stage >= 2)
             {
-                Case caseObj = cases->nth(i);
-                branch_class* caseBranch = static_cast<branch_class*>(caseObj);
-
-                Symbol idName = caseBranch->get_name();
-                if (strcmp(idName->get_string(), self->get_string()) == 0)
+                // Join the branch that was just checked into the type of the whole case
+                typeEnvironment.FreeLocalSlot();
+                if (frame.m_type != nullptr)
                 {
-                    semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                    error_stream << "case branch identier cannot be named self" << endl;
+                    frame.m_type = FirstCommonAncestor(frame.m_type, frame.m_childType, typeEnvironment);
                 }
-                
-                Symbol typeDecl = caseBranch->get_type();
-                Expression branchExpr = caseBranch->get_expr();
-
-                if (branchTypes.find(typeDecl) != branchTypes.end())
+                else
                 {
-                    semant_error(typeEnvironment.m_currentClass->get_filename(), branchExpr);
-                    error_stream << "Branches in a case statement with the same type are illegal" << endl;
-                    return nullptr;
+                    frame.m_type = frame.m_childType;
                 }
-                branchTypes.insert(typeDecl);
-                
-                typeEnvironment.EnterScope(); // case scope
+                typeEnvironment.ExitScope();
+            }
 
-                typeEnvironment.m_symbols.addid(idName->get_string(), typeDecl);
-                Symbol currentBranchExprType = TypeCheckExpression(typeEnvironment, branchExpr);
+            Cases cases = typecaseExpr->get_cases();
+            int i = stage - 1;
+            if (cases->more(i) == false) return nullptr;
 
-                if (expressionType != nullptr) 
-                {
-                    expressionType = FirstCommonAncestor(expressionType, currentBranchExprType, typeEnvironment);
-                } 
-                else
-                {
-                    expressionType = currentBranchExprType;
-                }
+            branch_class* caseBranch = static_cast<branch_class*>(cases->nth(i));
 
-                typeEnvironment.ExitScope();
+            Symbol idName = caseBranch->get_name();
+            if (strcmp(idName->get_string(), self->get_string()) == 0)
+            {
+                semant_error(typeEnvironment, expression, DiagnosticCode::BindSelf) << "case branch identier cannot be named self" << endl;
             }
 
-            break;
+            Symbol typeDecl = caseBranch->get_type();
+            Expression branchExpr = caseBranch->get_expr();
+
+            if (frame.m_branchTypes.find(typeDecl) != frame.m_branchTypes.end())
+            {
+                semant_error(typeEnvironment, branchExpr, DiagnosticCode::CaseDuplicateType) << "Branches in a case statement with the same type are illegal" << endl;
+                frame.m_type = nullptr;
+                return nullptr;
+            }
+            frame.m_branchTypes.insert(typeDecl);
+
+            RecordDependency(typeEnvironment, typeDecl);
+            typeEnvironment.EnterScope(); // case scope
+            typeEnvironment.m_symbols.addid(idName->get_string(), typeEnvironment.NewIdentifier(typeDecl, Binding{BindingKind::Local, typeEnvironment.AllocateLocalSlot()}));
+            return branchExpr;
         }
         case ExpressionType::Loop:
         {
             loop_class* loopExpr = static_cast<loop_class*>(expression);
-            Expression loopPred = loopExpr->get_pred();
-            Expression loopBody = loopExpr->get_body();
+            if (stage == 0) return loopExpr->get_pred();
 
-            if (TypeCheckExpression(typeEnvironment, loopPred) != Bool)
+            if (stage == 1)
             {
-                semant_error(typeEnvironment.m_currentClass->get_filename(), loopExpr);
-                error_stream << "Loop predicate must be of type Bool" << endl;
+                if (frame.m_childType != Bool)
+                {
+                    semant_error(typeEnvironment, loopExpr, DiagnosticCode::LoopPredicate) << "Loop predicate must be of type Bool" << endl;
+                    return nullptr;
+                }
+                return loopExpr->get_body();
             }
-            else if (TypeCheckExpression(typeEnvironment, loopBody) != nullptr)
+
+            if (frame.m_childType != nullptr)
             {
-                expressionType = Object;
+                frame.m_type = Object;
             }
-            break;
+            return nullptr;
         }
         case ExpressionType::IsVoid:
         {
-            if (TypeCheckExpression(typeEnvironment, expression->get_rhs()) != nullptr)
+            if (stage == 0) return expression->get_rhs();
+
+            if (frame.m_childType != nullptr)
             {
-                expressionType = Bool;
+                frame.m_type = Bool;
             }
-
-            break;
+            return nullptr;
         }
         case ExpressionType::Comp:
         {
-            if (TypeCheckExpression(typeEnvironment, expression->get_rhs()) != Bool)
+            if (stage == 0) return expression->get_rhs();
+
+            if (frame.m_childType != Bool)
             {
-                semant_error(typeEnvironment.m_currentClass->get_filename(), expression->get_rhs());
-                error_stream << "not operator only takes expressions of type Bool" << endl;
+                semant_error(typeEnvironment, expression->get_rhs(), DiagnosticCode::NotOperand) << "not operator only takes expressions of type Bool" << endl;
             }
             else
             {
-                expressionType = Bool;
+                frame.m_type = Bool;
             }
-
-            break;
+            return nullptr;
         }
         case ExpressionType::Neg:
         {
-            if (TypeCheckExpression(typeEnvironment, expression->get_rhs()) != Int)
+            if (stage == 0) return expression->get_rhs();
+
+            if (frame.m_childType != Int)
             {
-                semant_error(typeEnvironment.m_currentClass->get_filename(), expression->get_rhs());
-                error_stream << "neg operator only takes expressions of type Int" << endl;
+                semant_error(typeEnvironment, expression->get_rhs(), DiagnosticCode::NegOperand) << "neg operator only takes expressions of type Int" << endl;
             }
             else
             {
-                expressionType = Int;
+                frame.m_type = Int;
             }
-
-            break;
+            return nullptr;
         }
         case ExpressionType::IntConst:
         {
-            expressionType = Int;
-            break;
+            frame.m_type = Int;
+            return nullptr;
         }
         case ExpressionType::BoolConst:
         {
-            expressionType = Bool;
-            break;
+            frame.m_type = Bool;
+            return nullptr;
         }
         case ExpressionType::StringConst:
         {
-            expressionType = Str;
-            break;
+            frame.m_type = Str;
+            return nullptr;
         }
         case ExpressionType::Object:
         {
-            std::string symbolName = static_cast<object_class*>(expression)->get_name()->get_string();
+            object_class* objectExpr = static_cast<object_class*>(expression);
+            std::string symbolName = objectExpr->get_name()->get_string();
+            count_event(HotCounter::StringTemporaries);
 
             if (symbolName == self->get_string())
             {
-                expressionType = SELF_TYPE;
+                frame.m_type = SELF_TYPE;
+                objectExpr->set_binding(Binding{BindingKind::Self, 0});
             }
             else
             {
-                expressionType = typeEnvironment.m_symbols.lookup(symbolName);
-                if (expressionType == nullptr)
+                IdentifierInfo* identifierInfo = typeEnvironment.m_symbols.lookup(symbolName);
+                typeEnvironment.m_cost.m_symbolLookups++;
+                count_event(HotCounter::SymbolLookups);
+                if (identifierInfo == nullptr)
+                {
+                    semant_error(typeEnvironment, expression, DiagnosticCode::UndefinedIdentifier) << "Identifier not defined in this scope" << endl;
+                }
+                else
                 {
-                    semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                    error_stream << "Identifier not defined in this scope" << endl;
+                    frame.m_type = identifierInfo->m_type;
+                    objectExpr->set_binding(identifierInfo->m_binding);
                 }
             }
-            break;
+            return nullptr;
         }
         case ExpressionType::Eq:
         {
-            Symbol lhs = TypeCheckExpression(typeEnvironment, expression->get_lhs());
-            Symbol rhs = TypeCheckExpression(typeEnvironment, expression->get_rhs());
+            if (stage == 0) return expression->get_lhs();
+
+            if (stage == 1)
+            {
+                frame.m_savedType = frame.m_childType; // lhs type
+                return expression->get_rhs();
+            }
+
+            Symbol lhs = frame.m_savedType;
+            Symbol rhs = frame.m_childType;
             if (lhs != nullptr && rhs != nullptr)
             {
                 if ((lhs == Int && rhs != Int) || (lhs == Str && rhs != Str)|| (lhs == Bool && rhs != Bool))
                 {
-                    semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                    error_stream << "Comparison can only be made between two basic types" << endl;
+                    semant_error(typeEnvironment, expression, DiagnosticCode::ComparisonType) << "Comparison can only be made between two basic types" << endl;
                     return nullptr;
                 }
-                expressionType = Bool;
+                frame.m_type = Bool;
             }
-            break;
+            return nullptr;
         }
         case ExpressionType::Lt:
         case ExpressionType::Leq:
@@ -1059,69 +2478,1024 @@ Symbol ClassTable::TypeCheckExpression(TypeEnvironment& typeEnvironment,  Expres
         case ExpressionType::Divide:
         case ExpressionType::Mul:
         {
-            Symbol lhs = TypeCheckExpression(typeEnvironment, expression->get_lhs());
-            Symbol rhs = TypeCheckExpression(typeEnvironment, expression->get_rhs());
+            if (stage == 0) return expression->get_lhs();
+
+            if (stage == 1)
+            {
+                frame.m_savedType = frame.m_childType; // lhs type
+                return expression->get_rhs();
+            }
+
+            Symbol lhs = frame.m_savedType;
+            Symbol rhs = frame.m_childType;
             if (lhs == nullptr || lhs != Int || rhs == nullptr || rhs != Int)
             {
-                semant_error(typeEnvironment.m_currentClass->get_filename(), expression);
-                error_stream << "Opeation is only valid between two Ints" << endl;
-                expressionType = nullptr;
-                break;
+                semant_error(typeEnvironment, expression, DiagnosticCode::ArithmeticOperand) << "Opeation is only valid between two Ints" << endl;
+                return nullptr;
             }
 
             if (expression->get_expr_type() == ExpressionType::Lt || expression->get_expr_type() == ExpressionType::Leq)
             {
-                expressionType = Bool;
+                frame.m_type = Bool;
             }
             else
             {
-                expressionType = Int;
+                frame.m_type = Int;
             }
-            break;
+            return nullptr;
         }
         default:
         {
             abort(); // All expression types must be handled
         }
     }
+}
+
+void DependencyGraph::AddFeature(Class_ currentClass, Feature feature, const std::vector<std::string>& dependencies)
+{
+    int featureIndex = m_features.size();
+    m_features.push_back({ currentClass->get_name(), feature->get_name(), feature->is_attr(), currentClass->get_filename(), feature->get_line_number(), dependencies });
 
-    if (expressionType != nullptr)
+    for (const std::string& className : dependencies)
     {
-        expression->set_type(expressionType);
+        m_dependents[className].push_back(featureIndex);
     }
-    return expressionType;
 }
 
-////////////////////////////////////////////////////////////////////
+const std::vector<int>& DependencyGraph::GetAffectedFeatures(const std::string& className) const
+{
+    static const std::vector<int> noFeatures;
+    auto found = m_dependents.find(className);
+    return found != m_dependents.end() ? found->second : noFeatures;
+}
+
+void DependencyGraph::WriteAffectedFeatures(ostream& stream, const std::string& className) const
+{
+    const std::vector<int>& affected = GetAffectedFeatures(className);
+    stream << affected.size() << (affected.size() == 1 ? " feature depends" : " features depend") << " on class " << className << "\n";
+    for (int featureIndex : affected)
+    {
+        const FeatureNode& feature = m_features[featureIndex];
+        stream << feature.m_filename << ":" << feature.m_lineNumber << ": " << feature.m_className << "." << feature.m_featureName
+               << (feature.m_isAttribute ? " (attribute)\n" : " (method)\n");
+    }
+    stream << std::flush;
+}
+
+// File layout, the dependents section answers "what must be re-checked if this class changes" with one line:
+//   cool-dependencies 1
+//   features <count>
+//   <class> <attr|method> <name> <line> <filename>
+//   depends <count> <class> ...                     (one line per feature, same order)
+//   dependents <count>
+//   <class> <count> <feature index> ...
+bool DependencyGraph::Save(const char* path) const
+{
+    std::ofstream stream(path, std::ios::trunc);
+    stream << "cool-dependencies 1\n" << "features " << m_features.size() << "\n";
+    for (const FeatureNode& feature : m_features)
+    {
+        stream << feature.m_className << " " << (feature.m_isAttribute ? "attr " : "method ") << feature.m_featureName << " "
+               << feature.m_lineNumber << " " << feature.m_filename << "\n";
+        stream << "depends " << feature.m_dependencies.size();
+        for (const std::string& className : feature.m_dependencies)
+        {
+            stream << " " << className;
+        }
+        stream << "\n";
+    }
+
+    stream << "dependents " << m_dependents.size() << "\n";
+    for (const auto& entry : m_dependents)
+    {
+        stream << entry.first << " " << entry.second.size();
+        for (int featureIndex : entry.second)
+        {
+            stream << " " << featureIndex;
+        }
+        stream << "\n";
+    }
+
+    stream.close();
+    return static_cast<bool>(stream);
+}
+
+// A class's signature is everything about it that another feature's check can observe: its parent, the names and
+// types of its attributes and the signatures of its methods. Bodies and line numbers are left out on purpose.
+void ClassTable::ComputeClassSignatures()
+{
+    for(int i = m_classes->first(); m_classes->more(i); i = m_classes->next(i))
+    {
+        Class_ currentClass = m_classes->nth(i);
+
+        std::ostringstream signature;
+        signature << currentClass->get_name() << " " << currentClass->get_parent() << "\n";
+        Features features = currentClass->get_features();
+        for (int i = features->first(); features->more(i); i = features->next(i))
+        {
+            Feature feature = features->nth(i);
+            signature << (feature->is_attr() ? "attr " : "method ") << feature->get_name();
+            if (feature->is_attr() == false)
+            {
+                Formals formals = static_cast<method_class*>(feature)->get_formals();
+                for(int i = formals->first(); formals->more(i); i = formals->next(i))
+                {
+                    signature << " " << formals->nth(i)->get_name() << ":" << formals->nth(i)->get_type();
+                }
+            }
+            signature << " : " << feature->get_type() << "\n";
+        }
+
+        // Classes defined twice keep the signature of the first definition, like the rest of the checker
+        m_classSignatures.insert({ currentClass->get_name()->get_string(), HashString(signature.str()) });
+    }
+}
+
+// Record that the feature being checked depends on a class, every ancestor is recorded too since conformance
+// checks, joins and method lookups all walk up the hierarchy
+void ClassTable::RecordDependency(TypeEnvironment& typeEnvironment, Symbol className)
+{
+    if (typeEnvironment.m_recordDependencies == false || className == nullptr) return;
+
+    if (className == SELF_TYPE) className = typeEnvironment.m_currentClass->get_name();
+
+    std::string name = className->get_string();
+    while (typeEnvironment.m_dependencies.insert(name).second)
+    {
+        const InheritanceNode* node = FindInheritanceNode(name);
+        if (node == nullptr || node->GetParent() == nullptr) break;
+
+        name = node->GetParent()->GetName();
+        if (name == No_class->get_string()) break;
+    }
+}
+
+uint64_t ClassTable::FeatureFingerprint(Class_ currentClass, Feature feature) const
+{
+    // Only what the parser produced goes in, never the types and bindings a check adds, so the same tree hashes the
+    // same before and after it is annotated. The filename and line numbers are part of the fingerprint because they
+    // are part of the feature's diagnostics. Expressions are hashed in pre-order with the number of children of every
+    // node that can have any number of them, which is enough to tell two different trees apart.
+    ShapeHasher hasher;
+    hasher.AddSymbol(currentClass->get_filename());
+    hasher.AddSymbol(currentClass->get_name());
+    hasher.AddNumber(feature->is_attr());
+    hasher.AddNumber(feature->get_line_number());
+    hasher.AddSymbol(feature->get_name());
+    hasher.AddSymbol(feature->get_type());
+    if (feature->is_attr() == false)
+    {
+        Formals formals = static_cast<method_class*>(feature)->get_formals();
+        hasher.AddNumber(formals->len());
+        for (int i = formals->first(); formals->more(i); i = formals->next(i))
+        {
+            hasher.AddNumber(formals->nth(i)->get_line_number());
+            hasher.AddSymbol(formals->nth(i)->get_name());
+            hasher.AddSymbol(formals->nth(i)->get_type());
+        }
+    }
+
+    std::vector<Expression> expressions;
+    CollectExpressions(feature->get_expression(), expressions);
+    for (Expression expression : expressions)
+    {
+        hasher.AddNumber(static_cast<int>(expression->get_expr_type()));
+        hasher.AddNumber(expression->get_line_number());
+        switch (expression->get_expr_type())
+        {
+            case ExpressionType::Assign:
+                hasher.AddSymbol(static_cast<assign_class*>(expression)->get_symbol_name());
+                break;
+            case ExpressionType::StaticDispatch:
+                hasher.AddSymbol(expression->get_dispatch_subclass_type());
+                // fall through
+            case ExpressionType::Dispatch:
+                hasher.AddSymbol(expression->get_dispatch_method_name());
+                hasher.AddNumber(expression->get_dispatch_param_expressions()->len());
+                break;
+            case ExpressionType::TypeCase:
+            {
+                Cases cases = static_cast<typcase_class*>(expression)->get_cases();
+                hasher.AddNumber(cases->len());
+                for (int i = cases->first(); cases->more(i); i = cases->next(i))
+                {
+                    branch_class* branch = static_cast<branch_class*>(cases->nth(i));
+                    hasher.AddNumber(branch->get_line_number());
+                    hasher.AddSymbol(branch->get_name());
+                    hasher.AddSymbol(branch->get_type());
+                }
+                break;
+            }
+            case ExpressionType::Block:
+                hasher.AddNumber(static_cast<block_class*>(expression)->get_body()->len());
+                break;
+            case ExpressionType::Let:
+                hasher.AddSymbol(static_cast<let_class*>(expression)->get_let_id());
+                hasher.AddSymbol(static_cast<let_class*>(expression)->get_let_type_decl());
+                break;
+            case ExpressionType::IntConst:
+                hasher.AddSymbol(static_cast<int_const_class*>(expression)->get_token());
+                break;
+            case ExpressionType::StringConst:
+                hasher.AddSymbol(static_cast<string_const_class*>(expression)->get_token());
+                break;
+            case ExpressionType::BoolConst:
+                hasher.AddNumber(static_cast<bool_const_class*>(expression)->get_val());
+                break;
+            case ExpressionType::New:
+                hasher.AddSymbol(static_cast<new__class*>(expression)->get_type_name());
+                break;
+            case ExpressionType::Object:
+                hasher.AddSymbol(static_cast<object_class*>(expression)->get_name());
+                break;
+            default:
+                break; // the rest have a fixed number of children and nothing else
+        }
+    }
+    return hasher.GetHash();
+}
+
+bool ClassTable::DependenciesUnchanged(const FeatureResult& result) const
+{
+    for (const std::pair<std::string, uint64_t>& dependency : result.m_dependencies)
+    {
+        auto found = m_classSignatures.find(dependency.first);
+        uint64_t signature = found != m_classSignatures.end() ? found->second : 0; // 0 for classes that don't exist
+        if (signature != dependency.second) return false;
+    }
+    return true;
+}
+
+FeatureResult ClassTable::CaptureFeatureResult(TypeEnvironment& typeEnvironment, Class_ currentClass, Feature feature,
+                                               uint64_t fingerprint) const
+{
+    FeatureResult result;
+    result.m_className = currentClass->get_name()->get_string();
+    result.m_featureName = feature->get_name()->get_string();
+    result.m_isAttribute = feature->is_attr();
+    result.m_fingerprint = fingerprint;
+    result.m_localSlots = feature->get_local_slots();
+    result.m_diagnostics = typeEnvironment.m_diagnostics.GetDiagnostics();
+
+    for (const std::string& className : typeEnvironment.m_dependencies)
+    {
+        auto found = m_classSignatures.find(className);
+        result.m_dependencies.push_back({ className, found != m_classSignatures.end() ? found->second : 0 });
+    }
+
+    std::vector<Expression> expressions;
+    CollectExpressions(feature->get_expression(), expressions);
+    for (Expression expression : expressions)
+    {
+        FeatureResult::Annotation annotation;
+        annotation.m_type = expression->get_type();
+        if (expression->get_expr_type() == ExpressionType::Object)
+        {
+            annotation.m_binding = static_cast<object_class*>(expression)->get_binding();
+        }
+        else if (expression->get_expr_type() == ExpressionType::Assign)
+        {
+            annotation.m_binding = static_cast<assign_class*>(expression)->get_binding();
+        }
+        result.m_annotations.push_back(annotation);
+    }
+
+    return result;
+}
+
+void ClassTable::ApplyFeatureResult(Feature feature, const FeatureResult& result) const
+{
+    std::vector<Expression> expressions;
+    CollectExpressions(feature->get_expression(), expressions);
+    if (expressions.size() != result.m_annotations.size())
+    {
+        abort(); // Same fingerprint means the same body shape, this should never happen
+    }
+
+    for (size_t i = 0; i < expressions.size(); i++)
+    {
+        const FeatureResult::Annotation& annotation = result.m_annotations[i];
+        if (annotation.m_type != nullptr)
+        {
+            expressions[i]->set_type(annotation.m_type);
+        }
+
+        if (expressions[i]->get_expr_type() == ExpressionType::Object)
+        {
+            static_cast<object_class*>(expressions[i])->set_binding(annotation.m_binding);
+        }
+        else if (expressions[i]->get_expr_type() == ExpressionType::Assign)
+        {
+            static_cast<assign_class*>(expressions[i])->set_binding(annotation.m_binding);
+        }
+    }
+
+    feature->set_local_slots(result.m_localSlots);
+}
+
+void write_bindings(Program program, ostream& stream)
+{
+    Classes classes = program->get_classes();
+    for(int i = classes->first(); classes->more(i); i = classes->next(i))
+    {
+        Class_ currentClass = classes->nth(i);
+        Features features = currentClass->get_features();
+        for(int j = features->first(); features->more(j); j = features->next(j))
+        {
+            Feature feature = features->nth(j);
+            write_feature_slots(stream, feature->get_line_number(), currentClass->get_name()->get_string(), feature->get_name()->get_string(), feature->get_local_slots());
+
+            // in pre-order like the nodes of the binary typed AST
+            std::vector<Expression> expressions;
+            CollectExpressions(feature->get_expression(), expressions);
+            for (Expression expression : expressions)
+            {
+                if (expression->get_expr_type() == ExpressionType::Object)
+                {
+                    object_class* objectExpr = static_cast<object_class*>(expression);
+                    write_binding(stream, objectExpr->get_line_number(), objectExpr->get_name()->get_string(), objectExpr->get_binding());
+                }
+                else if (expression->get_expr_type() == ExpressionType::Assign)
+                {
+                    assign_class* assignExpr = static_cast<assign_class*>(expression);
+                    write_binding(stream, assignExpr->get_line_number(), assignExpr->get_symbol_name()->get_string(), assignExpr->get_binding());
+                }
+            }
+        }
+    }
+}
+
+//
+// Query protocol helpers. Requests are flat JSON objects whose values are strings, numbers, booleans or null, which
+// is all the editor side sends, so this is not a general JSON reader.
+//
+struct JsonValue
+{
+    std::string m_text;
+    bool m_isString = false;
+};
+
+static bool ParseJsonString(const std::string& text, size_t& position, std::string& value)
+{
+    if (position >= text.size() || text[position] != '"') return false;
+    position++;
+
+    while (position < text.size() && text[position] != '"')
+    {
+        char c = text[position++];
+        if (c != '\\')
+        {
+            value += c;
+            continue;
+        }
+
+        if (position >= text.size()) return false;
+        char escaped = text[position++];
+        switch (escaped)
+        {
+            case 'n': value += '\n'; break;
+            case 't': value += '\t'; break;
+            case 'r': value += '\r'; break;
+            case 'b': value += '\b'; break;
+            case 'f': value += '\f'; break;
+            case 'u':
+            {
+                if (position + 4 > text.size()) return false;
+                unsigned int code = strtoul(text.substr(position, 4).c_str(), nullptr, 16);
+                position += 4;
+                // UTF-8 encode, surrogate pairs are not combined
+                if (code < 0x80)
+                {
+                    value += static_cast<char>(code);
+                }
+                else if (code < 0x800)
+                {
+                    value += static_cast<char>(0xc0 | (code >> 6));
+                    value += static_cast<char>(0x80 | (code & 0x3f));
+                }
+                else
+                {
+                    value += static_cast<char>(0xe0 | (code >> 12));
+                    value += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                    value += static_cast<char>(0x80 | (code & 0x3f));
+                }
+                break;
+            }
+            default: value += escaped; break; // \" \\ and \/
+        }
+    }
+
+    if (position >= text.size()) return false;
+    position++;
+    return true;
+}
+
+static bool ParseJsonObject(const std::string& text, std::map<std::string, JsonValue>& fields)
+{
+    size_t position = 0;
+    auto skipSpace = [&]() {
+        while (position < text.size() && isspace(static_cast<unsigned char>(text[position]))) position++;
+    };
+
+    skipSpace();
+    if (position >= text.size() || text[position++] != '{') return false;
+    skipSpace();
+    if (position < text.size() && text[position] == '}')
+    {
+        position++;
+    }
+    else
+    {
+        for (;;)
+        {
+            std::string key;
+            skipSpace();
+            if (ParseJsonString(text, position, key) == false) return false;
+            skipSpace();
+            if (position >= text.size() || text[position++] != ':') return false;
+            skipSpace();
+
+            JsonValue& value = fields[key];
+            if (position < text.size() && text[position] == '"')
+            {
+                value.m_isString = true;
+                if (ParseJsonString(text, position, value.m_text) == false) return false;
+            }
+            else
+            {
+                size_t start = position;
+                while (position < text.size() && text[position] != ',' && text[position] != '}' &&
+                       !isspace(static_cast<unsigned char>(text[position])))
+                {
+                    position++;
+                }
+                if (position == start) return false;
+                value.m_text = text.substr(start, position - start);
+            }
+
+            skipSpace();
+            if (position >= text.size()) return false;
+            char separator = text[position++];
+            if (separator == '}') break;
+            if (separator != ',') return false;
+        }
+    }
+
+    skipSpace();
+    return position == text.size();
+}
+
+static void WriteJsonString(ostream& stream, const std::string& text)
+{
+    stream << '"';
+    for (char c : text)
+    {
+        switch (c)
+        {
+            case '"': stream << "\\\""; break;
+            case '\\': stream << "\\\\"; break;
+            case '\n': stream << "\\n"; break;
+            case '\t': stream << "\\t"; break;
+            case '\r': stream << "\\r"; break;
+            case '\b': stream << "\\b"; break;
+            case '\f': stream << "\\f"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    stream << escaped;
+                }
+                else
+                {
+                    stream << c;
+                }
+                break;
+        }
+    }
+    stream << '"';
+}
+
+static void WriteJsonSymbol(ostream& stream, Symbol symbol)
+{
+    if (symbol == nullptr)
+    {
+        stream << "null";
+        return;
+    }
+    WriteJsonString(stream, symbol->get_string());
+}
+
+QueryIndex::QueryIndex(Program program)
+{
+    Symbol basicClassFilename;
+    std::vector<Classes> classLists = { shared_basic_classes(basicClassFilename), program->get_classes() };
+    for (Classes classes : classLists)
+    {
+        for (int i = classes->first(); classes->more(i); i = classes->next(i))
+        {
+            Class_ currentClass = classes->nth(i);
+            m_classes[currentClass->get_name()->get_string()] = currentClass;
+
+            Features features = currentClass->get_features();
+            for (int j = features->first(); features->more(j); j = features->next(j))
+            {
+                Feature feature = features->nth(j);
+                MemberKey key(currentClass->get_name()->get_string(), feature->get_name()->get_string());
+                (feature->is_attr() ? m_attributes : m_methods)[key] = feature;
+
+                if (currentClass->get_filename() == basicClassFilename) continue; // no bodies to query
+
+                IndexedFeature indexed;
+                indexed.m_class = currentClass;
+                indexed.m_feature = feature;
+                indexed.m_firstLine = feature->get_line_number();
+                indexed.m_lastLine = indexed.m_firstLine;
+                CollectExpressions(feature->get_expression(), indexed.m_expressions, &indexed.m_parents);
+                for (Expression expression : indexed.m_expressions)
+                {
+                    indexed.m_lastLine = std::max(indexed.m_lastLine, expression->get_line_number());
+                }
+                m_files[currentClass->get_filename()->get_string()].m_features.push_back(m_features.size());
+                m_features.push_back(std::move(indexed));
+            }
+        }
+    }
+
+    for (auto& entry : m_files)
+    {
+        FileIndex& file = entry.second;
+        std::stable_sort(file.m_features.begin(), file.m_features.end(), [this](int a, int b) {
+            return m_features[a].m_firstLine < m_features[b].m_firstLine;
+        });
+        int maxLastLine = 0;
+        for (int featureIndex : file.m_features)
+        {
+            maxLastLine = std::max(maxLastLine, m_features[featureIndex].m_lastLine);
+            file.m_maxLastLine.push_back(maxLastLine);
+        }
+    }
+
+    // Call sites are filed under the class that defines the method the dispatch reaches, so asking for the
+    // callers of an inherited method finds the dispatches through every subclass that does not override it
+    for (int featureIndex = 0; featureIndex < static_cast<int>(m_features.size()); featureIndex++)
+    {
+        const IndexedFeature& feature = m_features[featureIndex];
+        for (int i = 0; i < static_cast<int>(feature.m_expressions.size()); i++)
+        {
+            Expression expression = feature.m_expressions[i];
+            if (expression->get_expr_type() != ExpressionType::Dispatch && expression->get_expr_type() != ExpressionType::StaticDispatch)
+            {
+                continue;
+            }
+
+            Feature method = nullptr;
+            Class_ definingClass = FindMember(ReceiverClass(feature, expression), expression->get_dispatch_method_name()->get_string(), false, method);
+            if (definingClass == nullptr) continue;
+            m_callers[MemberKey(definingClass->get_name()->get_string(), method->get_name()->get_string())].push_back({ featureIndex, i });
+        }
+    }
+}
+
+void QueryIndex::FindFeatures(const std::string& filename, int line, std::vector<int>& features) const
+{
+    for (const auto& entry : m_files)
+    {
+        if (filename.empty() == false && entry.first != filename) continue;
+
+        const FileIndex& file = entry.second;
+        auto after = std::upper_bound(file.m_features.begin(), file.m_features.end(), line, [this](int line, int featureIndex) {
+            return line < m_features[featureIndex].m_firstLine;
+        });
+
+        size_t numFound = features.size();
+        for (int i = static_cast<int>(after - file.m_features.begin()) - 1; i >= 0 && file.m_maxLastLine[i] >= line; i--)
+        {
+            if (m_features[file.m_features[i]].m_lastLine >= line) features.push_back(file.m_features[i]);
+        }
+        std::reverse(features.begin() + numFound, features.end());
+    }
+}
+
+Class_ QueryIndex::FindMember(const std::string& className, const std::string& name, bool isAttribute, Feature& feature) const
+{
+    const std::map<MemberKey, Feature>& members = isAttribute ? m_attributes : m_methods;
+    std::string currentName = className;
+    for (size_t depth = 0; depth <= m_classes.size(); depth++) // bounded in case the program had an inheritance cycle
+    {
+        auto found = m_classes.find(currentName);
+        if (found == m_classes.end()) return nullptr;
+
+        auto member = members.find(MemberKey(currentName, name));
+        if (member != members.end())
+        {
+            feature = member->second;
+            return found->second;
+        }
+        currentName = found->second->get_parent()->get_string();
+    }
+    return nullptr;
+}
+
+std::string QueryIndex::ReceiverClass(const IndexedFeature& feature, Expression dispatch) const
+{
+    Symbol receiverType = dispatch->get_expr_type() == ExpressionType::StaticDispatch
+        ? dispatch->get_dispatch_subclass_type()
+        : dispatch->get_dispatch_id_expr()->get_type();
+    if (receiverType == nullptr) return "";
+    return receiverType == SELF_TYPE ? feature.m_class->get_name()->get_string() : receiverType->get_string();
+}
+
+// Writes one definition object for what the expression refers to, false if it refers to nothing that can be found
+bool QueryIndex::WriteDefinition(ostream& stream, const IndexedFeature& feature, int expression) const
+{
+    Expression node = feature.m_expressions[expression];
+    const char* kind = nullptr;
+    Symbol name = nullptr;
+    Class_ definingClass = nullptr;
+    tree_node* definition = nullptr;
+
+    switch (node->get_expr_type())
+    {
+        case ExpressionType::Dispatch:
+        case ExpressionType::StaticDispatch:
+        {
+            Feature method = nullptr;
+            kind = "method";
+            name = node->get_dispatch_method_name();
+            definingClass = FindMember(ReceiverClass(feature, node), name->get_string(), false, method);
+            definition = method;
+            break;
+        }
+        case ExpressionType::New:
+        {
+            kind = "class";
+            name = static_cast<new__class*>(node)->get_type_name();
+            auto found = m_classes.find(name == SELF_TYPE ? feature.m_class->get_name()->get_string() : name->get_string());
+            if (found != m_classes.end()) definingClass = found->second;
+            definition = definingClass;
+            break;
+        }
+        case ExpressionType::Object:
+        case ExpressionType::Assign:
+        {
+            Binding binding;
+            if (node->get_expr_type() == ExpressionType::Object)
+            {
+                name = static_cast<object_class*>(node)->get_name();
+                binding = static_cast<object_class*>(node)->get_binding();
+            }
+            else
+            {
+                name = static_cast<assign_class*>(node)->get_symbol_name();
+                binding = static_cast<assign_class*>(node)->get_binding();
+            }
+
+            definingClass = feature.m_class;
+            if (binding.kind == BindingKind::Attribute)
+            {
+                Feature attribute = nullptr;
+                kind = "attribute";
+                definingClass = FindMember(feature.m_class->get_name()->get_string(), name->get_string(), true, attribute);
+                definition = attribute;
+            }
+            else if (binding.kind == BindingKind::Formal && feature.m_feature->is_attr() == false)
+            {
+                Formals formals = static_cast<method_class*>(feature.m_feature)->get_formals();
+                kind = "formal";
+                definition = formals->nth(binding.index);
+            }
+            else if (binding.kind == BindingKind::Local)
+            {
+                // The innermost enclosing let or case branch that binds the name, a let's own initializer can't see it
+                kind = "local";
+                for (int child = expression, parent = feature.m_parents[expression]; parent >= 0 && definition == nullptr;
+                     child = parent, parent = feature.m_parents[parent])
+                {
+                    Expression scope = feature.m_expressions[parent];
+                    if (scope->get_expr_type() == ExpressionType::Let)
+                    {
+                        let_class* letExpr = static_cast<let_class*>(scope);
+                        if (letExpr->get_let_id() == name && letExpr->get_let_body() == feature.m_expressions[child]) definition = letExpr;
+                    }
+                    else if (scope->get_expr_type() == ExpressionType::TypeCase)
+                    {
+                        Cases cases = static_cast<typcase_class*>(scope)->get_cases();
+                        for (int i = cases->first(); cases->more(i); i = cases->next(i))
+                        {
+                            branch_class* branch = static_cast<branch_class*>(cases->nth(i));
+                            if (branch->get_name() == name && branch->get_expr() == feature.m_expressions[child]) definition = branch;
+                        }
+                    }
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (kind == nullptr || definingClass == nullptr || definition == nullptr) return false;
+
+    stream << "{\"name\":";
+    WriteJsonSymbol(stream, name);
+    stream << ",\"kind\":\"" << kind << "\",\"class\":";
+    WriteJsonSymbol(stream, definingClass->get_name());
+    stream << ",\"file\":";
+    WriteJsonSymbol(stream, definingClass->get_filename());
+    stream << ",\"line\":" << definition->get_line_number() << "}";
+    return true;
+}
+
+std::string QueryIndex::Hover(const std::string& filename, int line) const
+{
+    std::vector<int> features;
+    FindFeatures(filename, line, features);
+
+    // The first expression on the line in pre-order is the outermost one, its type is the answer
+    std::ostringstream expressions;
+    Symbol type = nullptr;
+    bool found = false;
+    for (int featureIndex : features)
+    {
+        const IndexedFeature& feature = m_features[featureIndex];
+        for (Expression expression : feature.m_expressions)
+        {
+            if (expression->get_line_number() != line || expression->get_expr_type() == ExpressionType::NoExpr) continue;
+
+            if (found == false) type = expression->get_type();
+            expressions << (found ? "," : "") << "{\"kind\":\"" << expression_kind_name(expression->get_expr_type()) << "\",\"type\":";
+            WriteJsonSymbol(expressions, expression->get_type());
+            expressions << "}";
+            found = true;
+        }
+    }
+
+    std::ostringstream body;
+    body << "\"type\":";
+    WriteJsonSymbol(body, type);
+    body << ",\"expressions\":[" << expressions.str() << "]";
+    return body.str();
+}
+
+std::string QueryIndex::Definition(const std::string& filename, int line) const
+{
+    std::vector<int> features;
+    FindFeatures(filename, line, features);
+
+    std::ostringstream body;
+    body << "\"definitions\":[";
+    bool first = true;
+    for (int featureIndex : features)
+    {
+        const IndexedFeature& feature = m_features[featureIndex];
+        for (int i = 0; i < static_cast<int>(feature.m_expressions.size()); i++)
+        {
+            if (feature.m_expressions[i]->get_line_number() != line) continue;
+
+            std::ostringstream definition;
+            if (WriteDefinition(definition, feature, i))
+            {
+                body << (first ? "" : ",") << definition.str();
+                first = false;
+            }
+        }
+    }
+    body << "]";
+    return body.str();
+}
+
+std::string QueryIndex::Callers(const std::string& className, const std::string& methodName) const
+{
+    std::ostringstream body;
+    body << "\"callers\":[";
+
+    Feature method = nullptr;
+    Class_ definingClass = FindMember(className, methodName, false, method);
+    auto callSites = definingClass != nullptr ? m_callers.find(MemberKey(definingClass->get_name()->get_string(), methodName)) : m_callers.end();
+    if (callSites != m_callers.end())
+    {
+        bool first = true;
+        for (const CallSite& callSite : callSites->second)
+        {
+            const IndexedFeature& feature = m_features[callSite.m_feature];
+            body << (first ? "" : ",") << "{\"file\":";
+            WriteJsonSymbol(body, feature.m_class->get_filename());
+            body << ",\"line\":" << feature.m_expressions[callSite.m_expression]->get_line_number() << ",\"class\":";
+            WriteJsonSymbol(body, feature.m_class->get_name());
+            body << ",\"feature\":";
+            WriteJsonSymbol(body, feature.m_feature->get_name());
+            body << "}";
+            first = false;
+        }
+    }
+    body << "]";
+    return body.str();
+}
+
+std::string QueryIndex::Answer(const std::string& request) const
+{
+    std::map<std::string, JsonValue> fields;
+    bool parsed = ParseJsonObject(request, fields);
+
+    std::ostringstream response;
+    response << "{\"id\":";
+    auto id = fields.find("id");
+    if (id == fields.end()) response << "null";
+    else if (id->second.m_isString) WriteJsonString(response, id->second.m_text);
+    else response << id->second.m_text;
+
+    const std::string& method = fields["method"].m_text;
+    const std::string& filename = fields["file"].m_text;
+    int line = atoi(fields["line"].m_text.c_str());
+    if (parsed == false) response << ",\"error\":\"malformed request\"";
+    else if (method == "hover") response << "," << Hover(filename, line);
+    else if (method == "definition") response << "," << Definition(filename, line);
+    else if (method == "callers") response << "," << Callers(fields["class"].m_text, fields["name"].m_text);
+    else response << ",\"error\":\"unknown method\"";
+    response << "}";
+    return response.str();
+}
+
+////////////////////////////////////////////////////////////////////
 //
 // semant_error is an overloaded function for reporting errors
-// during semantic analysis.  There are three versions:
+// during semantic analysis.  There are four versions:
+//
+//    ostream& ClassTable::semant_error(DiagnosticCode code)
+//       an error about the whole program, without a location
 //
-//    ostream& ClassTable::semant_error()
+//    ostream& ClassTable::semant_error(Class_ c, DiagnosticCode code)
+//       record line number and filename for `c'
 //
-//    ostream& ClassTable::semant_error(Class_ c)
-//       print line number and filename for `c'
+//    ostream& ClassTable::semant_error(Symbol filename, tree_node *t, DiagnosticCode code)
+//       record a line number and filename
 //
-//    ostream& ClassTable::semant_error(Symbol filename, tree_node *t)
-//       print a line number and filename
+//    ostream& ClassTable::semant_error(TypeEnvironment& typeEnvironment, tree_node *t, DiagnosticCode code)
+//       record a line number and the current class's filename in the
+//       environment's diagnostics, used while checking features
+//
+// Each call starts a diagnostic record and returns the stream for its
+// message. Nothing is printed until FlushDiagnostics.
 //
 ///////////////////////////////////////////////////////////////////
 
-ostream& ClassTable::semant_error(Class_ c)
+ostream& ClassTable::semant_error(Class_ c, DiagnosticCode code)
+{
+    return semant_error(c->get_filename(), c, code);
+}
+
+ostream& ClassTable::semant_error(Symbol filename, tree_node *t, DiagnosticCode code)
 {
-    return semant_error(c->get_filename(),c);
+    semant_errors++;
+    return m_diagnostics.Begin(filename, t->get_line_number(), code);
 }
 
-ostream& ClassTable::semant_error(Symbol filename, tree_node *t)
+ostream& ClassTable::semant_error(TypeEnvironment& typeEnvironment, tree_node *t, DiagnosticCode code)
 {
-    error_stream << filename << ":" << t->get_line_number() << ": ";
-    return semant_error();
+    return typeEnvironment.m_diagnostics.Begin(typeEnvironment.m_currentClass->get_filename(), t->get_line_number(), code);
 }
 
-ostream& ClassTable::semant_error()
+ostream& ClassTable::semant_error(DiagnosticCode code)
 {
     semant_errors++;
-    return error_stream;
+    return m_diagnostics.Begin(nullptr, 0, code);
+}
+
+ostream& DiagnosticList::Begin(Symbol filename, int line, DiagnosticCode code)
+{
+    FinishMessage();
+
+    Diagnostic diagnostic;
+    if (filename != nullptr) diagnostic.m_filename = filename->get_string();
+    diagnostic.m_line = line;
+    diagnostic.m_code = code;
+    m_diagnostics.push_back(std::move(diagnostic));
+    m_messagePending = true;
+    return m_message;
+}
+
+void DiagnosticList::FinishMessage()
+{
+    if (m_messagePending == false) return;
+
+    std::string message = m_message.str();
+    if (message.empty() == false && message.back() == '\n') message.pop_back();
+    m_diagnostics.back().m_message = std::move(message);
+    m_message.str("");
+    m_messagePending = false;
+}
+
+const std::vector<Diagnostic>& DiagnosticList::GetDiagnostics()
+{
+    FinishMessage();
+    return m_diagnostics;
+}
+
+void DiagnosticList::Append(const std::vector<Diagnostic>& diagnostics)
+{
+    FinishMessage();
+    m_diagnostics.insert(m_diagnostics.end(), diagnostics.begin(), diagnostics.end());
+}
+
+void DiagnosticList::Clear()
+{
+    FinishMessage();
+    m_diagnostics.clear();
+}
+
+// Indexed by DiagnosticCode
+static const char* diagnosticCodeNames[] = {
+    "internal", "interface-read", "interface-write", "dependency-graph-write", "self-type-redefined", "inherits-basic-class", "class-redefined",
+    "inheritance-cycle", "undefined-parent", "main-undefined", "method-redefined", "formal-named-self",
+    "formal-self-type", "formal-redefined", "main-method-undefined", "override-mismatch", "attribute-named-self",
+    "attribute-redefined", "self-type-return", "method-return-type", "attribute-init-type", "assign-type",
+    "conditional-predicate", "static-dispatch-self-type", "static-dispatch-type", "undefined-method",
+    "dispatch-argument-type", "dispatch-signature", "bind-self", "let-init-type", "case-duplicate-type",
+    "loop-predicate", "not-operand", "neg-operand", "undefined-identifier", "comparison-type", "arithmetic-operand"
+};
+static_assert(sizeof(diagnosticCodeNames) / sizeof(diagnosticCodeNames[0]) == static_cast<int>(DiagnosticCode::ArithmeticOperand) + 1,
+              "every diagnostic code needs a name");
+
+std::map<std::string, int> ClassTable::DiagnosticFileOrder() const
+{
+    std::map<std::string, int> fileOrder;
+    for(int i = m_classes->first(); m_classes->more(i); i = m_classes->next(i))
+    {
+        fileOrder.insert({ m_classes->nth(i)->get_filename()->get_string(), fileOrder.size() });
+    }
+    fileOrder[""] = fileOrder.size();
+    return fileOrder;
+}
+
+void ClassTable::FlushDiagnostics()
+{
+    AllocationScope allocationScope(AllocationSubsystem::Output);
+
+    // Sort by file in program order, then by line. Errors about the whole program have no file and go last. The
+    // sort is stable, so the errors on one line stay in the order they were found.
+    std::map<std::string, int> fileOrder = DiagnosticFileOrder();
+
+    std::vector<Diagnostic> diagnostics = m_diagnostics.GetDiagnostics();
+    for (const Diagnostic& diagnostic : diagnostics)
+    {
+        fileOrder.insert({ diagnostic.m_filename, fileOrder.size() }); // files of interface errors
+    }
+    std::stable_sort(diagnostics.begin(), diagnostics.end(), [&fileOrder](const Diagnostic& a, const Diagnostic& b) {
+        int fileA = fileOrder[a.m_filename];
+        int fileB = fileOrder[b.m_filename];
+        return fileA != fileB ? fileA < fileB : a.m_line < b.m_line;
+    });
+
+    std::set<std::tuple<std::string, int, DiagnosticCode, std::string>> seen;
+    std::vector<Diagnostic> unique;
+    for (Diagnostic& diagnostic : diagnostics)
+    {
+        if (seen.insert(std::make_tuple(diagnostic.m_filename, diagnostic.m_line, diagnostic.m_code, diagnostic.m_message)).second)
+        {
+            unique.push_back(std::move(diagnostic));
+        }
+    }
+
+    // Reaching the limit stops the run whether or not more errors would have followed, as -fmax-errors does in
+    // gcc. Whether a skipped feature would have had any can't be known, and the output must not depend on which
+    // features the workers skipped.
+    bool truncated = semant_max_errors > 0 && static_cast<int>(unique.size()) >= semant_max_errors;
+    if (truncated) unique.resize(semant_max_errors);
+
+    std::ostringstream text;
+    if (semant_diagnostics_json)
+    {
+        text << "{\"errors\":" << unique.size() << ",\"truncated\":" << (truncated ? "true" : "false") << ",\"diagnostics\":[";
+        for (size_t i = 0; i < unique.size(); i++)
+        {
+            text << (i > 0 ? "," : "") << "{\"file\":";
+            if (unique[i].m_filename.empty()) text << "null";
+            else WriteJsonString(text, unique[i].m_filename);
+            text << ",\"line\":" << unique[i].m_line << ",\"code\":\"" << diagnosticCodeNames[static_cast<int>(unique[i].m_code)]
+                 << "\",\"message\":";
+            WriteJsonString(text, unique[i].m_message);
+            text << "}";
+        }
+        text << "]}\n";
+    }
+    else
+    {
+        for (const Diagnostic& diagnostic : unique)
+        {
+            if (diagnostic.m_filename.empty() == false) text << diagnostic.m_filename << ":" << diagnostic.m_line << ": ";
+            text << diagnostic.m_message << "\n";
+        }
+        if (truncated) text << "Too many errors, stopped after " << unique.size() << "." << "\n";
+    }
+
+    // One write, the error stream is usually the unbuffered cerr
+    std::string output = text.str();
+    error_stream.write(output.data(), output.size());
+    error_stream.flush();
+
+    m_diagnostics.Clear();
+    semant_errors = unique.size();
 }
 
 
@@ -1140,18 +3514,58 @@ ostream& ClassTable::semant_error()
      to build mycoolc.
  */
 void program_class::semant()
+{
+    SemantResult result = semant_program(this);
+    cerr << result.m_diagnostics;
+    if (result.m_errors) {
+        if (semant_diagnostics_json == 0) cerr << "Compilation halted due to static semantic errors." << endl;
+        exit(1);
+    }
+}
+
+void initialize_semant()
+{
+    initialize_constants();
+    Symbol basicClassFilename;
+    shared_basic_classes(basicClassFilename);
+}
+
+static int check_classes(Classes classes, ostream& errorStream, IncrementalState* incrementalState,
+    const ClassCheckedCallback& onClassChecked)
 {
     initialize_constants();
 
     /* ClassTable constructor may do some semantic analysis */
-    ClassTable *classtable = new ClassTable(classes);
+    std::unique_ptr<ClassTable> classtable = std::make_unique<ClassTable>(classes, errorStream, incrementalState, onClassChecked);
 
     /* some semantic analysis code may go here */
 
-    if (classtable->errors()) {
-        cerr << "Compilation halted due to static semantic errors." << endl;
-        exit(1);
+    if (classtable->errors() == 0 && semant_export_file != NULL)
+    {
+        classtable->ExportInterface(semant_export_file);
+    }
+
+    if (semant_dependency_file != NULL && classtable->GetDependencyGraph().Save(semant_dependency_file) == false)
+    {
+        classtable->semant_error(DiagnosticCode::DependencyGraphWrite) << "Could not write dependency graph file " << semant_dependency_file << endl;
     }
+
+    if (semant_affected_class != NULL)
+    {
+        classtable->GetDependencyGraph().WriteAffectedFeatures(cerr, semant_affected_class);
+    }
+
+    classtable->FlushDiagnostics();
+    return classtable->errors();
+}
+
+SemantResult semant_program(Program program, IncrementalState* incrementalState, const ClassCheckedCallback& onClassChecked)
+{
+    std::ostringstream diagnostics;
+    SemantResult result;
+    result.m_errors = check_classes(program->get_classes(), diagnostics, incrementalState, onClassChecked);
+    result.m_diagnostics = diagnostics.str();
+    return result;
 }
 
 
@@ -5,13 +5,24 @@
 #include <iostream>  
 #include "cool-tree.h"
 #include "stringtab.h"
-#include "symtab.h"
 #include "list.h"
+#include "allocation-profile.h"
+#include "counters.h"
+#include "phase-timer.h"
+#include "check-cost.h"
 
+#include <cstdint>
+#include <chrono>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <sstream>
+#include <deque>
+#include <functional>
+#include <mutex>
 #include <memory>
 #include <utility>
+#include <tuple>
 #include <vector>
 
 #define TRUE 1
@@ -37,7 +48,7 @@ public:
 private:
     std::string m_name;
     std::set<InheritanceNode*> m_children;
-    InheritanceNode* m_parent; 
+    InheritanceNode* m_parent = nullptr;
     int m_numDescendants = 0;
     bool m_visited = false;
 };
@@ -59,7 +70,7 @@ public:
   }
 
   Symbol GetReturnType() const { return m_returnType; }
-  const std::vector<Symbol> GetFormalTypes() const { return m_formalTypes; }
+  const std::vector<Symbol>& GetFormalTypes() const { return m_formalTypes; }
 
   bool operator ==(const MethodInfo& other) const {
     return m_returnType == other.m_returnType && m_formalTypes == other.m_formalTypes;
@@ -80,8 +91,8 @@ public:
   MethodKey() = default;
   MethodKey(const MethodKey& other) = default;
   MethodKey(Class_ classObject, method_class* methodObject): 
-    m_key({ classObject->get_name()->get_string(), methodObject->get_name()->get_string() }) {}
-  MethodKey(std::string className, std::string methodName): m_key({ className, methodName }) {}
+    m_key({ classObject->get_name()->get_string(), methodObject->get_name()->get_string() }) { count_event(HotCounter::StringTemporaries, 2); }
+  MethodKey(std::string className, std::string methodName): m_key({ className, methodName }) { count_event(HotCounter::StringTemporaries, 2); }
 
   bool operator <(const MethodKey& other) const {
     return m_key < other.m_key;
@@ -94,17 +105,432 @@ private:
 // Map from class name + method name to the list of formals for that method
 typedef std::map<MethodKey, MethodInfo> MethodMap;
 
+// What the symbol table stores for each identifier: its declared type and where the variable lives
+struct IdentifierInfo
+{
+  IdentifierInfo(Symbol type, Binding binding) : m_type(type), m_binding(binding) {}
+
+  Symbol m_type;
+  Binding m_binding;
+};
+
+// One expression waiting on the type checker's explicit stack
+struct CheckFrame
+{
+  CheckFrame(Expression expression) : m_expression(expression) {}
+
+  Expression m_expression;
+  int m_stage = 0;                   // number of times the frame has been resumed
+  Symbol m_childType = nullptr;      // static type of the child that was just checked
+  Symbol m_type = nullptr;           // static type of the expression, valid once the frame is complete
+  Symbol m_savedType = nullptr;      // an earlier child's type that is still needed (lhs, then branch, dispatch receiver)
+  bool m_isSelfTypeReceiver = false;
+  const MethodInfo* m_method = nullptr;
+  std::set<Symbol> m_branchTypes;
+};
+
+// Entries and scopes of identifier environments. They are never freed one at a time: an arena lives as long as
+// its owner and Rewind lets every entry be reused once no environment built in the arena is in use any more.
+class SymbolArena
+{
+public:
+  struct Entry
+  {
+    std::string m_id;
+    IdentifierInfo* m_info;
+    const Entry* m_next; // the entry added before it to the same scope
+  };
+
+  struct Scope
+  {
+    const Entry* m_entries; // latest first
+    const Scope* m_outer;
+  };
+
+  const Entry* NewEntry(const std::string& id, IdentifierInfo* info, const Entry* next)
+  {
+    if (m_entriesUsed == m_entries.size()) m_entries.emplace_back();
+    Entry& entry = m_entries[m_entriesUsed++];
+    entry.m_id = id; // a reused entry keeps its string's buffer
+    entry.m_info = info;
+    entry.m_next = next;
+    return &entry;
+  }
+
+  const Scope* NewScope(const Entry* entries, const Scope* outer)
+  {
+    if (m_scopesUsed == m_scopes.size()) m_scopes.emplace_back();
+    Scope& scope = m_scopes[m_scopesUsed++];
+    scope.m_entries = entries;
+    scope.m_outer = outer;
+    return &scope;
+  }
+
+  void Rewind() { m_entriesUsed = 0; m_scopesUsed = 0; }
+
+private:
+  std::deque<Entry> m_entries; // a deque never moves its elements
+  std::deque<Scope> m_scopes;
+  size_t m_entriesUsed = 0;
+  size_t m_scopesUsed = 0;
+};
+
+// Identifier environments are persistent: entering a scope or adding an id never mutates an existing scope,
+// so copying a SymbolEnvironment is cheap and the copy shares every scope that was already there. New scopes and
+// entries come from the environment's arena, which must outlive it and every environment copied from it.
+class SymbolEnvironment
+{
+public:
+  explicit SymbolEnvironment(SymbolArena* arena) : m_arena(arena) {}
+
+  // Starts from the scopes of environment, which may be in another arena, and adds to arena
+  SymbolEnvironment(const SymbolEnvironment& environment, SymbolArena* arena) : m_arena(arena), m_scopes(environment.m_scopes) {}
+
+  void enterscope() { m_scopes = m_arena->NewScope(nullptr, m_scopes); }
+  void exitscope() { m_scopes = m_scopes->m_outer; }
+
+  void addid(const std::string& id, IdentifierInfo* info)
+  {
+    m_scopes = m_arena->NewScope(m_arena->NewEntry(id, info, m_scopes->m_entries), m_scopes->m_outer);
+  }
+
+  IdentifierInfo* lookup(const std::string& id) const
+  {
+    for (const SymbolArena::Scope* scope = m_scopes; scope != nullptr; scope = scope->m_outer)
+    {
+      for (const SymbolArena::Entry* entry = scope->m_entries; entry != nullptr; entry = entry->m_next)
+      {
+        if (entry->m_id == id) return entry->m_info;
+      }
+    }
+    return nullptr;
+  }
+
+private:
+  SymbolArena* m_arena;
+  const SymbolArena::Scope* m_scopes = nullptr;
+};
+
+// Identifies what a diagnostic is about independently of its message text, printed in JSON output
+enum class DiagnosticCode : unsigned char
+{
+  Internal,
+  InterfaceRead,
+  InterfaceWrite,
+  DependencyGraphWrite,
+  SelfTypeRedefined,
+  InheritsBasicClass,
+  ClassRedefined,
+  InheritanceCycle,
+  UndefinedParent,
+  MainUndefined,
+  MethodRedefined,
+  FormalNamedSelf,
+  FormalSelfType,
+  FormalRedefined,
+  MainMethodUndefined,
+  OverrideMismatch,
+  AttributeNamedSelf,
+  AttributeRedefined,
+  SelfTypeReturn,
+  MethodReturnType,
+  AttributeInitType,
+  AssignType,
+  ConditionalPredicate,
+  StaticDispatchSelfType,
+  StaticDispatchType,
+  UndefinedMethod,
+  DispatchArgumentType,
+  DispatchSignature,
+  BindSelf,
+  LetInitType,
+  CaseDuplicateType,
+  LoopPredicate,
+  NotOperand,
+  NegOperand,
+  UndefinedIdentifier,
+  ComparisonType,
+  ArithmeticOperand
+};
+
+struct Diagnostic
+{
+  std::string m_filename; // empty for diagnostics about the whole program
+  int m_line = 0;
+  DiagnosticCode m_code = DiagnosticCode::Internal;
+  std::string m_message;  // without the trailing newline
+};
+
+// Diagnostics in the order they were reported. Begin adds a record and returns the stream its message is written
+// to, the message is complete at the next Begin or when the records are read.
+class DiagnosticList
+{
+public:
+  ostream& Begin(Symbol filename, int line, DiagnosticCode code);
+  const std::vector<Diagnostic>& GetDiagnostics();
+  void Append(const std::vector<Diagnostic>& diagnostics);
+  int GetNumDiagnostics() const { return m_diagnostics.size(); }
+  void Clear();
+
+private:
+  void FinishMessage();
+
+  std::vector<Diagnostic> m_diagnostics;
+  std::ostringstream m_message;
+  bool m_messagePending = false;
+};
+
+// Scratch checking state for one worker. Features can be checked concurrently as long as each worker has its
+// own TypeEnvironment, everything else the checker reads lives in the ClassTable and is not modified.
 struct TypeEnvironment
 {
-  TypeEnvironment() { EnterScope(); }
+  TypeEnvironment() : m_symbols(&m_symbolArena) { m_symbols.enterscope(); } // not counted, there is one per worker and the counts must not depend on -j
 
   // todo: I should use a destructor here so that I don't need to explicitly call exitscope, scope would be exited when the item is destructed
-  void EnterScope() { m_symbols.enterscope(); }
+  void EnterScope() { m_symbols.enterscope(); count_event(HotCounter::ScopePushes); }
   void ExitScope() { m_symbols.exitscope(); }
 
-  SymbolTable<std::string, Entry> m_symbols;
-  MethodMap m_methodMap;
+  SymbolArena m_symbolArena; // formals and let/case variables, rewound for every feature
+  SymbolEnvironment m_symbols;
   Class_ m_currentClass = nullptr;
+
+  // Diagnostics for the feature being checked, merged into the class table's in program order
+  DiagnosticList m_diagnostics;
+
+  // let/case variables get frame slots in nesting order, sibling scopes reuse the same slots
+  int AllocateLocalSlot()
+  {
+    int slot = m_nextLocalSlot++;
+    if (m_nextLocalSlot > m_maxLocalSlots) m_maxLocalSlots = m_nextLocalSlot;
+    return slot;
+  }
+  void FreeLocalSlot() { m_nextLocalSlot--; }
+
+  int m_nextLocalSlot = 0;
+  int m_maxLocalSlots = 0;
+
+  // Reused by every TypeCheckExpression call on this environment
+  std::vector<CheckFrame> m_checkStack;
+
+  // Formals and let/case variables of the feature being checked. The arena is rewound for every feature so the
+  // entries are reused instead of allocated again.
+  IdentifierInfo* NewIdentifier(Symbol type, Binding binding)
+  {
+    if (m_identifiersUsed == m_identifierArena.size()) m_identifierArena.emplace_back(type, binding);
+    else m_identifierArena[m_identifiersUsed] = IdentifierInfo(type, binding);
+    return &m_identifierArena[m_identifiersUsed++];
+  }
+
+  std::deque<IdentifierInfo> m_identifierArena; // a deque never moves its elements
+  size_t m_identifiersUsed = 0;
+
+  // Classes whose signatures the feature being checked looked at, only gathered in incremental mode or when the
+  // dependency graph is exported
+  bool m_recordDependencies = false;
+  std::set<std::string> m_dependencies;
+
+  // Counted for every feature, CheckTypes only keeps the counts with -K or -F
+  CheckCost m_cost;
+};
+
+// Everything that checking one feature produced. The incremental mode keeps these between runs so that a feature
+// whose body and dependencies did not change can be annotated again without being checked.
+struct FeatureResult
+{
+  struct Annotation
+  {
+    Symbol m_type = nullptr;
+    Binding m_binding;
+  };
+
+  std::string m_className;                                       // with m_featureName and m_isAttribute the key in the state
+  std::string m_featureName;
+  bool m_isAttribute = false;
+  uint64_t m_fingerprint = 0;                                    // hash of the class name, filename and unannotated feature
+  std::vector<std::pair<std::string, uint64_t>> m_dependencies;  // signature hash of every class the check depended on
+  std::vector<Annotation> m_annotations;                         // one per expression of the body in pre-order
+  int m_localSlots = 0;
+  std::vector<Diagnostic> m_diagnostics;
+};
+
+// Feature results of a previous run, read from and written to the incremental state file or kept in memory by a
+// process that checks the same program again and again
+class IncrementalState
+{
+public:
+  bool Load(const char* path);
+  bool Save(const char* path) const;
+  const FeatureResult* Find(const std::string& className, const std::string& featureName, bool isAttribute) const;
+  void Add(const FeatureResult& result) { m_results[{ result.m_className, result.m_featureName, result.m_isAttribute }] = result; }
+  int GetNumResults() const { return m_results.size(); }
+
+private:
+  // An attribute and a method can share a name, so whether the feature is an attribute is part of the key
+  std::map<std::tuple<std::string, std::string, bool>, FeatureResult> m_results;
+};
+
+// Which classes every checked feature depends on, and the reverse edges: for each class the features that have to be
+// checked again when its signature changes. A feature depends on the classes it dispatches on, instantiates, names in
+// declarations and case branches or compares in conformance checks, and on all of their ancestors, so the reverse
+// edges of a single class are already the complete affected set.
+class DependencyGraph
+{
+public:
+  struct FeatureNode
+  {
+    Symbol m_className;
+    Symbol m_featureName;
+    bool m_isAttribute;
+    Symbol m_filename;
+    int m_lineNumber;
+    std::vector<std::string> m_dependencies;
+  };
+
+  void AddFeature(Class_ currentClass, Feature feature, const std::vector<std::string>& dependencies);
+  const std::vector<int>& GetAffectedFeatures(const std::string& className) const;
+  const FeatureNode& GetFeature(int featureIndex) const { return m_features[featureIndex]; }
+  bool Save(const char* path) const;
+
+  // Lists the features GetAffectedFeatures returns for className, one "<file>:<line>: <class>.<feature>" per line
+  void WriteAffectedFeatures(ostream& stream, const std::string& className) const;
+
+private:
+  std::vector<FeatureNode> m_features;
+  std::map<std::string, std::vector<int>> m_dependents; // class name to indices into m_features
+};
+
+// A memory-mapped class interface file, opening it only reads the index. The record of a class is handed out
+// when the class is first referenced.
+class InterfaceFile
+{
+public:
+  InterfaceFile() = default;
+  InterfaceFile(const InterfaceFile&) = delete;
+  InterfaceFile& operator=(const InterfaceFile&) = delete;
+  ~InterfaceFile();
+
+  bool Open(const char* path);
+  bool HasClass(const std::string& className) const;
+  std::string GetClassRecord(const std::string& className) const;
+  int GetNumClasses() const { return m_index.size(); }
+
+private:
+  const char* m_mapping = nullptr;
+  size_t m_size = 0;
+  const char* m_records = nullptr;
+  std::unordered_map<std::string, std::pair<size_t, size_t>> m_index; // class name to record offset and length
+};
+
+// Diagnostics and typed AST of whole runs, stored in the -C directory under a hash of the input AST text and of
+// the compiler build. A hit replays the stored output without parsing the input or running the analysis at all.
+// An entry also keeps the input and everything else it was computed from, which must match exactly before it is
+// replayed, so two inputs whose hashes collide can't be given each other's results.
+class SemantResultCache
+{
+public:
+  // Reads the imported interface files, which the results depend on like the input
+  explicit SemantResultCache(const char* directory);
+
+  uint64_t ComputeKey(const std::string& input) const;
+
+  // Writes the cached diagnostics to stderr and the typed AST to stdout, false if there is no usable entry
+  bool Replay(uint64_t key, const std::string& input, int& errors) const;
+  bool Store(uint64_t key, const std::string& input, const std::string& diagnostics, const std::string& output, int errors) const;
+
+private:
+  std::string GetPath(uint64_t key) const;
+
+  std::string m_directory;
+  std::string m_context; // the flags and interfaces an entry is for besides the input
+};
+
+// Answers editor queries about a checked program from its typed AST: the types of the expressions on a line, where
+// the methods, attributes, variables and classes used on a line are defined, and every call site of a method.
+// Requests and responses are single-line JSON objects, see semant-phase.cc for the protocol.
+class QueryIndex
+{
+public:
+  explicit QueryIndex(Program program);
+
+  std::string Answer(const std::string& request) const;
+
+private:
+  struct IndexedFeature
+  {
+    Class_ m_class;
+    Feature m_feature;
+    int m_firstLine;
+    int m_lastLine;
+    std::vector<Expression> m_expressions; // body in pre-order
+    std::vector<int> m_parents;            // pre-order index of each expression's parent, -1 for the root
+  };
+
+  // The features of one source file ordered by first line. Features don't nest, but an attribute and the next
+  // feature can share a line, so m_maxLastLine[i] is the largest last line of features 0..i and a lookup walks
+  // back from the last feature starting at or before the line until no earlier feature can reach it.
+  struct FileIndex
+  {
+    std::vector<int> m_features;  // indices into m_features
+    std::vector<int> m_maxLastLine;
+  };
+
+  struct CallSite
+  {
+    int m_feature;
+    int m_expression;
+  };
+
+  typedef std::pair<std::string, std::string> MemberKey; // class name, feature name
+
+  void FindFeatures(const std::string& filename, int line, std::vector<int>& features) const;
+  Class_ FindMember(const std::string& className, const std::string& name, bool isAttribute, Feature& feature) const;
+  std::string ReceiverClass(const IndexedFeature& feature, Expression dispatch) const;
+  bool WriteDefinition(ostream& stream, const IndexedFeature& feature, int expression) const;
+  std::string Hover(const std::string& filename, int line) const;
+  std::string Definition(const std::string& filename, int line) const;
+  std::string Callers(const std::string& className, const std::string& methodName) const;
+
+  std::vector<IndexedFeature> m_features;
+  std::map<std::string, FileIndex> m_files;
+  std::map<std::string, Class_> m_classes; // including the basic classes
+  std::map<MemberKey, Feature> m_methods;  // by the class that defines them
+  std::map<MemberKey, Feature> m_attributes;
+  std::map<MemberKey, std::vector<CallSite>> m_callers; // dispatches by the class that defines the method they reach
+};
+
+// Runs a fixed set of independent tasks on a pool of worker threads. Every worker owns a queue of task
+// indices, it takes the newest task from its own queue and when that runs dry steals the oldest task from
+// another worker's queue, so a few very large classes don't leave the other workers idle.
+class WorkStealingScheduler
+{
+public:
+  struct WorkerStats
+  {
+    int m_tasksRun = 0;
+    int m_steals = 0;
+    int m_failedSteals = 0; // victim queue was empty
+  };
+
+  // numWorkers <= 0 uses one worker per hardware thread, a single worker runs the tasks on the calling thread
+  explicit WorkStealingScheduler(int numWorkers);
+
+  // Calls work(task, worker) once for every task in [0, numTasks), the worker index can be used to pick worker local state
+  void Run(int numTasks, const std::function<void(int, int)>& work);
+
+  int GetNumWorkers() const { return m_queues.size(); }
+  const std::vector<WorkerStats>& GetStats() const { return m_stats; }
+
+private:
+  struct WorkerQueue
+  {
+    std::mutex m_mutex;
+    std::deque<int> m_tasks;
+  };
+
+  void RunWorker(int worker, const std::function<void(int, int)>& work);
+
+  std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+  std::vector<WorkerStats> m_stats; // each entry is only written by its own worker
 };
 
 // This is a structure that may be used to contain the semantic
@@ -115,30 +541,106 @@ struct TypeEnvironment
 // Map from class name to the entry in the inheritance node graph for that class
 typedef std::map<std::string, std::unique_ptr<InheritanceNode>> InheritanceNodeMap;
 
+// Called with each class of the checked program, in program order, as soon as all of its features have been
+// checked. It can be called from any worker thread, but never from two threads at once.
+typedef std::function<void(Class_)> ClassCheckedCallback;
+
+// What checking one program produced, the type annotations themselves are left on the program's AST
+struct SemantResult
+{
+  int m_errors = 0;
+  std::string m_diagnostics;
+};
+
+// New tree nodes are stamped from the global node_lineno and their names go into the global string tables, so
+// threads that parse or build nodes while other threads check take this lock
+extern std::mutex ast_mutex;
+
+// Interns the predefined symbols and builds the shared basic classes. semant_program does this on first use, but
+// threads that check programs concurrently need it done up front since it adds to the string tables.
+void initialize_semant();
+
+// Reentrant entry point: checks a program without printing or exiting and frees its class table before returning.
+// With an incremental state the features that are unchanged since the last check with that state reuse its
+// results, and the state is updated to this check. onClassChecked, if given, sees each class while later classes are
+// still being checked.
+SemantResult semant_program(Program program, IncrementalState* incrementalState = nullptr,
+  const ClassCheckedCallback& onClassChecked = nullptr);
+
+// Writes the -L listing of a checked program, see write_feature_slots
+void write_bindings(Program program, ostream& stream);
+
 class ClassTable {
 private:
   int semant_errors;
   void install_basic_classes();
+  void install_interface_classes();
+  Class_ ParseInterfaceClass(const std::string& record);
   bool ValidateInheritance();
   void CheckTypes();
-  bool IsClassChildOfClassOrEqual(Symbol childClass, Symbol potentialParentClass, const TypeEnvironment& typeEnvironment);
-  Symbol FirstCommonAncestor(Symbol C, Symbol T, const TypeEnvironment &TypeEnvironment);
-  Symbol TypeCheckExpression(TypeEnvironment& typeEnvironment, Expression expression);
+  void CheckFeature(TypeEnvironment& typeEnvironment, Class_ currentClass, Feature feature);
+  bool IsClassChildOfClassOrEqual(Symbol childClass, Symbol potentialParentClass, TypeEnvironment& typeEnvironment);
+  Symbol FirstCommonAncestor(Symbol C, Symbol T, TypeEnvironment &TypeEnvironment);
+  Symbol TypeCheckExpression(TypeEnvironment& typeEnvironment, Expression rootExpression);
+  Expression ResumeCheck(TypeEnvironment& typeEnvironment, CheckFrame& frame);
+  void BuildAttributeEnvironments(const SymbolEnvironment& globalSymbols);
+  void BuildAttributeEnvironment(const std::string& className, const SymbolEnvironment& globalSymbols);
+  const InheritanceNode* FindInheritanceNode(const std::string& className) const;
+  Class_ FindClass(const std::string& className) const;
+  IdentifierInfo* NewIdentifier(Symbol type, Binding binding);
+
+  // Incremental mode
+  void ComputeClassSignatures();
+  void RecordDependency(TypeEnvironment& typeEnvironment, Symbol className);
+  uint64_t FeatureFingerprint(Class_ currentClass, Feature feature) const;
+  bool DependenciesUnchanged(const FeatureResult& result) const;
+  FeatureResult CaptureFeatureResult(TypeEnvironment& typeEnvironment, Class_ currentClass, Feature feature, uint64_t fingerprint) const;
+  void ApplyFeatureResult(Feature feature, const FeatureResult& result) const;
 
-  ostream& error_stream;
+  // Index of each class file in program order, then "" for the diagnostics without a file. FlushDiagnostics sorts by it.
+  std::map<std::string, int> DiagnosticFileOrder() const;
+
+  ostream& error_stream; // where FlushDiagnostics writes
+  DiagnosticList m_diagnostics;
   Classes m_classes;
   InheritanceNodeMap m_inheritanceNodeMap;
+  MethodMap m_methodMap;
 
   // todo: pretty sure this can be removed if I include Symbol points to class type objects in the InheritanceNodes
   std::map<std::string, Class_> m_classMap; // Used in later passes for quick lookup by class name
 
+  // Map from class name to the frozen attribute environment for that class, built once and shared with child classes
+  std::map<std::string, SymbolEnvironment> m_attributeEnvironments;
+  std::map<std::string, int> m_attributeCounts; // Number of attributes in the class layout including inherited ones
+  std::deque<IdentifierInfo> m_identifiers; // class and attribute entries of the environments above
+  SymbolArena m_symbolArena; // their scopes and entries
+
+  // Map from class name to a hash of its parent, attribute types and method signatures
+  std::map<std::string, uint64_t> m_classSignatures;
+
   Symbol m_basicClassFilename;
+
+  // Classes read from interface files, they were checked when they were exported and have no bodies
+  std::vector<std::pair<std::string, std::unique_ptr<InterfaceFile>>> m_interfaceFiles;
+  std::set<Class_> m_interfaceClasses;
+  std::map<std::string, Symbol> m_interfaceSymbols;
+  DependencyGraph m_dependencyGraph;
+  IncrementalState* m_incrementalState; // in-memory results of the previous check, used instead of the state file
+  ClassCheckedCallback m_onClassChecked;
 public:
-  ClassTable(Classes);
+  ClassTable(Classes, ostream& errorStream, IncrementalState* incrementalState = nullptr,
+    const ClassCheckedCallback& onClassChecked = nullptr);
   int errors() { return semant_errors; }
-  ostream& semant_error();
-  ostream& semant_error(Class_ c);
-  ostream& semant_error(Symbol filename, tree_node *t);
+  bool ExportInterface(const char* path);
+
+  // Sorts and dedupes the diagnostics, applies the -M limit and writes them to the error stream in one piece, as
+  // text or as JSON with -J. Afterwards errors() is the number of diagnostics written.
+  void FlushDiagnostics();
+  const DependencyGraph& GetDependencyGraph() const { return m_dependencyGraph; }
+  ostream& semant_error(DiagnosticCode code);
+  ostream& semant_error(Class_ c, DiagnosticCode code);
+  ostream& semant_error(Symbol filename, tree_node *t, DiagnosticCode code);
+  ostream& semant_error(TypeEnvironment& typeEnvironment, tree_node *t, DiagnosticCode code);
 };
 
 
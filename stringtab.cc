@@ -7,6 +7,8 @@
 #include <assert.h>
 #include "stringtab_functions.h"
 #include "stringtab.h"
+#include "allocation-profile.h"
+#include "counters.h"
 
 extern char *pad(int n);
 
@@ -22,10 +24,16 @@ Entry::Entry(char *s, int l, int i) : len(l), index(i) {
   str = new char [len+1];
   strncpy(str, s, len);
   str[len] = '\0';
+  if (semant_counters) count_string_intern();
+  if (semant_allocation_profile) {
+    charge_to_interning(this); // made by the table with new
+    charge_to_interning(str);
+  }
 }
 
 int Entry::equal_string(char *string, int length) const
 {
+  if (semant_counters) count_string_probe();
   return (len == length) && (strncmp(str,string,len) == 0);
 }
 